@@ -0,0 +1,61 @@
+#!/bin/bash
+# Output throughput of oslab3: printf against per-thread batches flushed with write(),
+# with and without --atomic-lines, against writev() of the strings in place, io_uring
+# writes of registered buffers and the shared ring drained by one writer thread.
+# A fixed total of lines is split between the threads, every point is repeated
+# and the median lines/sec and MB/s are printed. io_uring needs a regular file.
+
+threads="1 8 64 1024"
+lines=2097152
+reps=3
+target=""
+extra=""
+
+usage() {
+    echo "usage: $0 [ -t \"1 8 64 1024\" ] [ -l lines ] [ -r repetitions ] [ -f output file, a temporary file by default ] [ -e \"extra args\" ]"
+    exit 5
+}
+
+while getopts "t:l:r:f:e:h" opt; do
+    case $opt in
+    t) threads=$OPTARG ;;
+    l) lines=$OPTARG ;;
+    r) reps=$OPTARG ;;
+    f) target=$OPTARG ;;
+    e) extra=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+cc -O2 "$root/oslab3.c" -o "$bin/l3.out" -lpthread || exit 1
+[ -z "$target" ] && target=$bin/lines
+
+modes=("--output=printf" "--output=buffered" "--output=buffered --atomic-lines"
+       "--output=writev" "--output=writev --atomic-lines" "--output=uring"
+       "--output=ring --backpressure=block" "--output=ring --backpressure=spin")
+
+median() {
+    echo "$@" | tr ' ' '\n' | sort -g | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+printf "%-8s %-34s %14s %10s\n" threads mode lines/sec MB/s
+for t in $threads
+do
+    args=("$t")
+    for ((i = 0; i < t; ++i)); do args+=("$(( lines / t ))"); done
+    for mode in "${modes[@]}"
+    do
+        rates=""
+        speeds=""
+        for ((r = 0; r < reps; ++r))
+        do
+            stats=$("$bin/l3.out" "${args[@]}" $mode --stats $extra 2>&1 > "$target")
+            rates="$rates $(echo "$stats" | grep -o 'lines/sec=[^ ]*' | cut -d= -f2)"
+            speeds="$speeds $(echo "$stats" | grep -o 'MB/s=[^ ]*' | cut -d= -f2)"
+        done
+        printf "%-8s %-34s %14.0f %10.1f\n" "$t" "$mode" "$(median $rates)" "$(median $speeds)"
+    done
+done
@@ -0,0 +1,100 @@
+/*
+ * False sharing microbenchmark for per-thread result slots.
+ * Every thread keeps adding to its own slot, once with slots packed back-to-back
+ * as threadLabNode used to be laid out, once with slots padded to a cache line.
+ *
+ * cc -O2 padding.c -o padding.out -lpthread
+ * ./padding.out [ iterations [ threads... ] ]
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LAB_NO_ERROR 0
+#define LAB_CANT_CREATE_THREADS 2
+#define LAB_BAD_ALLOC 6
+
+#define LAB_CACHE_LINE 64
+#define LAB_ITERATION_NUMBER 10000000
+
+typedef struct _packedSlot {
+    double result;
+    long terms;
+    int status;
+} packedSlot;
+
+typedef struct _paddedSlot {
+    double result;
+    long terms;
+    int status;
+} __attribute__((aligned(LAB_CACHE_LINE))) paddedSlot;
+
+typedef struct _benchParams {
+    volatile double *result;
+    volatile long *terms;
+    long iterations;
+} benchParams;
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void * run(void * param) {
+    benchParams *p = (benchParams*)param;
+    for (long i = 0; i < p->iterations; ++i) {
+        *p->result += 1.0;
+        *p->terms += 1;
+    }
+    return param;
+}
+
+/*
+ * Returns nanoseconds per iteration of one thread
+ */
+double measure(benchParams *params, long n) {
+    pthread_t threads[n];
+    double begin = now();
+    for (long i = 0; i < n; ++i) {
+        int code = pthread_create(&threads[i], NULL, run, &params[i]);
+        if (code != LAB_NO_ERROR) {
+            fprintf(stderr, "can't create thread: %s\n", strerror(code));
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+    }
+    for (long i = 0; i < n; ++i) pthread_join(threads[i], NULL);
+    return (now() - begin) * 1e9 / params[0].iterations;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : LAB_ITERATION_NUMBER;
+    long defaults[] = {1, 8, 32, 64};
+    int counts = argc > 2 ? argc - 2 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+
+    for (int c = 0; c < counts; ++c) {
+        long n = argc > 2 ? strtol(argv[c + 2], NULL, 10) : defaults[c];
+        packedSlot *packed = calloc(n, sizeof(packedSlot));
+        paddedSlot *padded = aligned_alloc(LAB_CACHE_LINE, sizeof(paddedSlot) * n);
+        benchParams *params = malloc(sizeof(benchParams) * n);
+        if (packed == NULL || padded == NULL || params == NULL) {
+            fprintf(stderr, "can't allocate slots: %s\n", strerror(ENOMEM));
+            exit(LAB_BAD_ALLOC);
+        }
+        memset(padded, 0, sizeof(paddedSlot) * n);
+
+        for (long i = 0; i < n; ++i) params[i] = (benchParams){&packed[i].result, &packed[i].terms, iterations};
+        double packedNs = measure(params, n);
+        for (long i = 0; i < n; ++i) params[i] = (benchParams){&padded[i].result, &padded[i].terms, iterations};
+        double paddedNs = measure(params, n);
+
+        printf("threads=%ld packed=%.3fns padded=%.3fns speedup=%.2f\n", n, packedNs, paddedNs, packedNs / paddedNs);
+        free(packed);
+        free(padded);
+        free(params);
+    }
+    return LAB_NO_ERROR;
+}
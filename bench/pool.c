@@ -0,0 +1,114 @@
+/*
+ * Per-call latency of small pi computations: fresh threads created and joined
+ * for every call as runMultiThreadCalculations() does, one job at a time
+ * on a persistent piPool, and all calls submitted to the pool as one batch.
+ *
+ * cc -O2 pool.c -o pool.out -lpthread -lm
+ * ./pool.out [ terms [ calls [ threads... ] ] ]
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../labpool.h"
+
+#define LAB_NO_ERROR 0
+#define LAB_CANT_CREATE_THREADS 2
+#define LAB_BAD_ALLOC 6
+
+#define LAB_TERMS 100000
+#define LAB_CALLS 1000
+
+typedef struct _benchParams {
+    leibnizSumFunc sum;
+    long from;
+    long count;
+    double result;
+} benchParams;
+
+void * run(void * param) {
+    benchParams *p = (benchParams*)param;
+    p->result = p->sum(p->from, 1, p->count);
+    return param;
+}
+
+double createJoinCall(leibnizSumFunc sum, long terms, long n) {
+    pthread_t threads[n];
+    benchParams params[n];
+    for (long i = 0; i < n; ++i) {
+        params[i] = (benchParams){sum, terms * i / n, terms * (i + 1) / n - terms * i / n, 0};
+        int code = pthread_create(&threads[i], NULL, run, &params[i]);
+        if (code != LAB_NO_ERROR) {
+            fprintf(stderr, "can't create thread: %s\n", strerror(code));
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+    }
+    double res = 0;
+    for (long i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+        res += params[i].result;
+    }
+    return 4 * res;
+}
+
+void submitOrDie(piPool *pool, piJob *job) {
+    int code = piPoolSubmit(pool, job);
+    if (code != LAB_NO_ERROR) {
+        fprintf(stderr, "can't submit job: %s\n", strerror(code));
+        exit(LAB_BAD_ALLOC);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long terms = argc > 1 ? strtol(argv[1], NULL, 10) : LAB_TERMS;
+    long calls = argc > 2 ? strtol(argv[2], NULL, 10) : LAB_CALLS;
+    long defaults[] = {1, 4, 16};
+    int counts = argc > 3 ? argc - 3 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+    leibnizSumFunc sum = leibnizSumFor(LAB_KERNEL_LEIBNIZ, detectSimd());
+
+    piJob *jobs = calloc(calls, sizeof(piJob));
+    if (jobs == NULL) {
+        fprintf(stderr, "can't allocate jobs: %s\n", strerror(ENOMEM));
+        exit(LAB_BAD_ALLOC);
+    }
+
+    for (int c = 0; c < counts; ++c) {
+        long n = argc > 3 ? strtol(argv[c + 3], NULL, 10) : defaults[c];
+        double check = 0;
+
+        double begin = labNow();
+        for (long i = 0; i < calls; ++i) check += createJoinCall(sum, terms, n);
+        double createJoin = (labNow() - begin) / calls;
+
+        piPool pool;
+        int code = piPoolInit(&pool, n, LAB_SIMD_AUTO);
+        if (code != LAB_NO_ERROR) {
+            fprintf(stderr, "can't start pool: %s\n", strerror(code));
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+
+        begin = labNow();
+        for (long i = 0; i < calls; ++i) {
+            jobs[i] = (piJob){.kernel = LAB_KERNEL_LEIBNIZ, .terms = terms, .first = 0};
+            submitOrDie(&pool, &jobs[i]);
+            check -= piPoolWait(&pool, &jobs[i]);
+        }
+        double single = (labNow() - begin) / calls;
+
+        begin = labNow();
+        for (long i = 0; i < calls; ++i) {
+            jobs[i] = (piJob){.kernel = LAB_KERNEL_LEIBNIZ, .terms = terms, .first = 0};
+            submitOrDie(&pool, &jobs[i]);
+        }
+        for (long i = 0; i < calls; ++i) piPoolWait(&pool, &jobs[i]);
+        double batched = (labNow() - begin) / calls;
+        piPoolShutdown(&pool);
+
+        printf("threads=%ld terms=%ld create/join=%.2fus pool=%.2fus batched=%.2fus speedup=%.2f difference=%.3g\n",
+            n, terms, createJoin * 1e6, single * 1e6, batched * 1e6, createJoin / single, check / calls);
+    }
+    free(jobs);
+    return LAB_NO_ERROR;
+}
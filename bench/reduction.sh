@@ -0,0 +1,66 @@
+#!/bin/bash
+# Cost of oslab8's reproducible reduction: the median wall time of --reduction=reproducible
+# against the ordered reduction for the same terms, kernel and thread count, and the
+# difference in percent. wall is the time oslab8 prints for the summation itself.
+
+kernels="leibniz paired"
+threads=""
+terms=400000000
+reps=5
+extra=""
+
+usage() {
+    echo "usage: $0 [ -k \"leibniz paired\" ] [ -t \"1 2 4\" ] [ -n terms ] [ -r repetitions ] [ -e \"extra args\" ]"
+    exit 5
+}
+
+while getopts "k:t:n:r:e:h" opt; do
+    case $opt in
+    k) kernels=$OPTARG ;;
+    t) threads=$OPTARG ;;
+    n) terms=$OPTARG ;;
+    r) reps=$OPTARG ;;
+    e) extra=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+
+if [ -z "$threads" ]
+then
+    cores=$(nproc)
+    threads=1
+    for ((t = 2; t < cores; t *= 2)); do threads="$threads $t"; done
+    [ "$cores" -gt 1 ] && threads="$threads $cores"
+fi
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+cc -O2 "$root/oslab8.c" -o "$bin/l8.out" -lpthread -lm || exit 1
+
+median() {
+    echo "$@" | tr ' ' '\n' | sort -g | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+# median wall of reps runs of oslab8 with the given arguments
+wall() {
+    local walls=""
+    for ((r = 0; r < reps; ++r))
+    do
+        walls="$walls $("$bin/l8.out" "$@" $extra | grep -o 'wall=[^ ]*' | head -1 | cut -d= -f2 | tr -d s)"
+    done
+    median $walls
+}
+
+printf "%-10s %8s %14s %14s %10s\n" kernel threads ordered reproducible overhead
+for k in $kernels
+do
+    for t in $threads
+    do
+        iterations=$(( terms / t ))
+        ordered=$(wall "$t" "$iterations" "--kernel=$k" --reduction=ordered)
+        reproducible=$(wall "$t" "$iterations" "--kernel=$k" --reduction=reproducible)
+        printf "%-10s %8s %13.6fs %13.6fs %9.1f%%\n" "$k" "$t" "$ordered" "$reproducible" \
+            "$(echo "$ordered $reproducible" | awk '{ print ($2 / $1 - 1) * 100 }')"
+    done
+done
@@ -0,0 +1,162 @@
+#!/bin/bash
+# Scaling benchmark for the pi programs.
+# Sweeps thread counts and work sizes for every program and kernel, repeats every point,
+# and writes <prefix>.csv, <prefix>.json and a text summary of the speedup curve.
+#
+# oslab8 gets a fixed total number of terms split between threads (strong scaling),
+# oslab9 runs for a fixed number of seconds and is stopped with SIGINT.
+# Efficiency is terms/sec at n threads divided by n * terms/sec at the smallest thread count.
+
+programs="8 9"
+kernels="leibniz paired"
+threads=""
+terms="100000000"
+seconds="2"
+reps=3
+warmup=1
+prefix="scaling"
+baseline=""
+tolerance=10
+extra=""
+
+usage() {
+    echo "usage: $0 [ -p \"8 9\" ] [ -k \"leibniz paired\" ] [ -t \"1 2 4\" ] [ -n \"terms...\" ] [ -d seconds ]"
+    echo "          [ -r repetitions ] [ -w warmup ] [ -o prefix ] [ -b baseline.summary.csv [ -x tolerance% ] ] [ -e \"extra args\" ]"
+    exit 5
+}
+
+while getopts "p:k:t:n:d:r:w:o:b:x:e:h" opt; do
+    case $opt in
+    p) programs=$OPTARG ;;
+    k) kernels=$OPTARG ;;
+    t) threads=$OPTARG ;;
+    n) terms=$OPTARG ;;
+    d) seconds=$OPTARG ;;
+    r) reps=$OPTARG ;;
+    w) warmup=$OPTARG ;;
+    o) prefix=$OPTARG ;;
+    b) baseline=$OPTARG ;;
+    x) tolerance=$OPTARG ;;
+    e) extra=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+
+if [ -z "$threads" ]
+then
+    cores=$(nproc)
+    threads=1
+    for ((t = 2; t < cores; t *= 2)); do threads="$threads $t"; done
+    [ "$cores" -gt 1 ] && threads="$threads $cores"
+fi
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+for p in $programs
+do
+    cc -O2 "$root/oslab$p.c" -o "$bin/l$p.out" -lpthread -lm || exit 1
+done
+
+# prints "wall user sys" followed by the program's rate line
+measure() {
+    local out=$bin/out
+    local times
+    TIMEFORMAT="%R %U %S"
+    times=$( { time "$@" > "$out" 2>/dev/null; } 2>&1 )
+    echo "$times $(grep '^kernel=' "$out" | head -1)"
+}
+
+field() {
+    echo "$2" | tr ' ' '\n' | grep "^$1=" | head -1 | cut -d= -f2 | tr -d 's'
+}
+
+csv=$prefix.csv
+echo "program,kernel,size,threads,terms,rep,wall,user,sys,terms_per_sec,error" > "$csv"
+
+for p in $programs
+do
+    for k in $kernels
+    do
+        for t in $threads
+        do
+            if [ "$p" = 8 ]; then sizes=$terms; else sizes=$seconds; fi
+            for size in $sizes
+            do
+                if [ "$p" = 8 ]
+                then
+                    cmd=("$bin/l8.out" "$t" "$(( ${size%%.*} / t ))" "--kernel=$k" $extra)
+                else
+                    cmd=(timeout -s INT "$size" "$bin/l9.out" "$t" "--kernel=$k" $extra)
+                fi
+
+                for ((w = 0; w < warmup; ++w)); do measure "${cmd[@]}" > /dev/null; done
+                for ((r = 1; r <= reps; ++r))
+                do
+                    line=$(measure "${cmd[@]}")
+                    read -r wall user sys rest <<< "$line"
+                    echo "oslab$p,$k,$size,$t,$(field terms "$rest"),$r,$wall,$user,$sys,$(field terms/sec "$rest"),$(field error "$rest")" >> "$csv"
+                done
+            done
+        done
+    done
+done
+
+# median terms/sec per point, speedup and efficiency against the smallest thread count
+summary=$(awk -F, 'NR > 1 {
+        key = $1 "," $2 "," $3 "," $4
+        n[key]++
+        tps[key, n[key]] = $10
+        err[key] = $11
+        if (!(key in seen)) { seen[key] = 1; order[++count] = key }
+    }
+    END {
+        for (i = 1; i <= count; ++i) {
+            key = order[i]
+            m = n[key]
+            for (a = 1; a <= m; ++a) v[a] = tps[key, a] + 0
+            for (a = 1; a <= m; ++a) for (b = a + 1; b <= m; ++b) if (v[b] < v[a]) { x = v[a]; v[a] = v[b]; v[b] = x }
+            split(key, parts, ",")
+            group = parts[1] "," parts[2] "," parts[3]
+            median = v[int((m + 1) / 2)]
+            if (!(group in base)) { base[group] = median; baseThreads[group] = parts[4] }
+            speedup = median / base[group]
+            efficiency = speedup * baseThreads[group] / parts[4]
+            printf "%s,%s,%s,%s,%.6g,%.3f,%.3f,%s\n", parts[1], parts[2], parts[3], parts[4], median, speedup, efficiency, err[key]
+        }
+    }' "$csv")
+
+{
+    echo "["
+    first=1
+    tail -n +2 "$csv" | while IFS=, read -r program kernel size t n rep wall user sys tps error
+    do
+        [ $first = 1 ] || echo ","
+        first=0
+        printf '  {"program": "%s", "kernel": "%s", "size": %s, "threads": %s, "terms": %s, "rep": %s, "wall": %s, "user": %s, "sys": %s, "terms_per_sec": %s, "error": %s}' \
+            "$program" "$kernel" "$size" "$t" "${n:-0}" "$rep" "$wall" "$user" "$sys" "${tps:-0}" "${error:-0}"
+    done
+    echo
+    echo "]"
+} > "$prefix.json"
+
+printf "%-8s %-10s %10s %8s %14s %8s %10s %12s\n" program kernel size threads terms/sec speedup efficiency error
+echo "$summary" | while IFS=, read -r program kernel size t tps speedup efficiency error
+do
+    printf "%-8s %-10s %10s %8s %14s %8s %10s %12s\n" "$program" "$kernel" "$size" "$t" "$tps" "$speedup" "$efficiency" "$error"
+done
+echo "$summary" > "$prefix.summary.csv"
+
+if [ -n "$baseline" ]
+then
+    # baseline is a previous <prefix>.summary.csv
+    regressions=$(awk -F, -v tol="$tolerance" 'NR == FNR { old[$1 "," $2 "," $3 "," $4] = $5; next }
+        ($1 "," $2 "," $3 "," $4) in old && $5 < old[$1 "," $2 "," $3 "," $4] * (1 - tol / 100) {
+            printf "regression: %s %s size=%s threads=%s terms/sec %s -> %s\n", $1, $2, $3, $4, old[$1 "," $2 "," $3 "," $4], $5
+        }' "$baseline" "$prefix.summary.csv")
+    if [ -n "$regressions" ]
+    then
+        echo "$regressions"
+        exit 1
+    fi
+fi
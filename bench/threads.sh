@@ -0,0 +1,45 @@
+#!/bin/bash
+# How oslab3 scales with the worker count: creation rate, peak rss and peak virtual
+# memory with default thread stacks against small stacks without guard pages.
+# Every worker prints a few lines through buffered output to /dev/null.
+
+counts="1000 10000 100000"
+lines=4
+stack=16384
+guard=0
+
+usage() {
+    echo "usage: $0 [ -n \"1000 10000 100000\" ] [ -l lines per worker ] [ -s small stack bytes ] [ -g guard bytes ]"
+    exit 5
+}
+
+while getopts "n:l:s:g:h" opt; do
+    case $opt in
+    n) counts=$OPTARG ;;
+    l) lines=$OPTARG ;;
+    s) stack=$OPTARG ;;
+    g) guard=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+cc -O2 "$root/oslab3.c" -o "$bin/l3.out" -lpthread || exit 1
+
+modes=("" "--stack=$stack --guard=$guard")
+
+printf "%-8s %-28s %12s %12s %14s %10s\n" workers stack creates/sec "rss KB" "vm KB" throttled
+for n in $counts
+do
+    args=("$n")
+    for ((i = 0; i < n; ++i)); do args+=("$lines"); done
+    for mode in "${modes[@]}"
+    do
+        stats=$("$bin/l3.out" "${args[@]}" --output=buffered $mode --stats 2>&1 > /dev/null)
+        field() { echo "$stats" | grep -o "$1=[^ ]*" | head -1 | cut -d= -f2 | tr -d KB; }
+        printf "%-8s %-28s %12.0f %12s %14s %10s\n" "$n" "${mode:-default}" "$(field creates/sec)" \
+            "$(field rss)" "$(field vm)" "$(field throttled)"
+    done
+done
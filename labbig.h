@@ -0,0 +1,619 @@
+#ifndef LAB_BIG_H
+#define LAB_BIG_H
+
+/*
+ * Self-contained arbitrary precision integers and pi engines built on them:
+ * Machin formula and Chudnovsky series with binary splitting.
+ * Numbers are little endian arrays of 32 bit limbs with a sign flag,
+ * multiplication and division are schoolbook.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define LAB_BIG_BAD_ALLOC 6
+#define LAB_BIG_GUARD_DIGITS 10
+
+typedef struct _bigInt {
+    uint32_t *limbs;
+    long size;
+    long capacity;
+    int negative;
+} bigInt;
+
+static inline void bigInit(bigInt *a) {
+    a->limbs = NULL;
+    a->size = 0;
+    a->capacity = 0;
+    a->negative = 0;
+}
+
+static inline void bigFree(bigInt *a) {
+    free(a->limbs);
+    bigInit(a);
+}
+
+static inline void bigReserve(bigInt *a, long capacity) {
+    if (capacity <= a->capacity) return;
+    uint32_t *limbs = realloc(a->limbs, sizeof(uint32_t) * capacity);
+    if (limbs == NULL) {
+        fprintf(stderr, "bignum of %ld limbs doesn't fit in memory\n", capacity);
+        exit(LAB_BIG_BAD_ALLOC);
+    }
+    a->limbs = limbs;
+    a->capacity = capacity;
+}
+
+static inline void bigTrim(bigInt *a) {
+    while (a->size > 0 && a->limbs[a->size - 1] == 0) a->size--;
+    if (a->size == 0) a->negative = 0;
+}
+
+static inline void bigSwap(bigInt *a, bigInt *b) {
+    bigInt t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static inline void bigSetU64(bigInt *a, uint64_t v) {
+    bigReserve(a, 2);
+    a->limbs[0] = (uint32_t)v;
+    a->limbs[1] = (uint32_t)(v >> 32);
+    a->size = 2;
+    a->negative = 0;
+    bigTrim(a);
+}
+
+static inline void bigCopy(bigInt *dst, const bigInt *src) {
+    if (dst == src) return;
+    bigReserve(dst, src->size);
+    if (src->size > 0) memcpy(dst->limbs, src->limbs, sizeof(uint32_t) * src->size);
+    dst->size = src->size;
+    dst->negative = src->negative;
+}
+
+static inline int bigIsZero(const bigInt *a) {
+    return a->size == 0;
+}
+
+static inline int bigCmpAbs(const bigInt *a, const bigInt *b) {
+    if (a->size != b->size) return a->size < b->size ? -1 : 1;
+    for (long i = a->size - 1; i >= 0; --i)
+        if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    return 0;
+}
+
+static inline void bigAddAbs(bigInt *r, const bigInt *a, const bigInt *b) {
+    if (a->size < b->size) {
+        const bigInt *t = a;
+        a = b;
+        b = t;
+    }
+    bigInt res;
+    bigInit(&res);
+    bigReserve(&res, a->size + 1);
+    uint64_t carry = 0;
+    for (long i = 0; i < a->size; ++i) {
+        carry += (uint64_t)a->limbs[i] + (i < b->size ? b->limbs[i] : 0);
+        res.limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    res.limbs[a->size] = (uint32_t)carry;
+    res.size = a->size + 1;
+    bigTrim(&res);
+    bigSwap(r, &res);
+    bigFree(&res);
+}
+
+/*
+ * |r| = |a| - |b|, requires |a| >= |b|
+ */
+static inline void bigSubAbs(bigInt *r, const bigInt *a, const bigInt *b) {
+    bigInt res;
+    bigInit(&res);
+    bigReserve(&res, a->size);
+    int64_t borrow = 0;
+    for (long i = 0; i < a->size; ++i) {
+        int64_t t = (int64_t)a->limbs[i] - (i < b->size ? b->limbs[i] : 0) - borrow;
+        borrow = t < 0;
+        res.limbs[i] = (uint32_t)t;
+    }
+    res.size = a->size;
+    bigTrim(&res);
+    bigSwap(r, &res);
+    bigFree(&res);
+}
+
+static inline void bigAdd(bigInt *r, const bigInt *a, const bigInt *b) {
+    int aNegative = a->negative, bNegative = b->negative;
+    if (aNegative == bNegative) {
+        bigAddAbs(r, a, b);
+        r->negative = bigIsZero(r) ? 0 : aNegative;
+    } else if (bigCmpAbs(a, b) >= 0) {
+        bigSubAbs(r, a, b);
+        r->negative = bigIsZero(r) ? 0 : aNegative;
+    } else {
+        bigSubAbs(r, b, a);
+        r->negative = bigIsZero(r) ? 0 : bNegative;
+    }
+}
+
+static inline void bigSub(bigInt *r, const bigInt *a, const bigInt *b) {
+    bigInt negated = *b;
+    negated.negative = bigIsZero(b) ? 0 : !b->negative;
+    bigAdd(r, a, &negated);
+}
+
+static inline void bigMul(bigInt *r, const bigInt *a, const bigInt *b) {
+    bigInt res;
+    bigInit(&res);
+    if (bigIsZero(a) || bigIsZero(b)) {
+        bigSwap(r, &res);
+        bigFree(&res);
+        return;
+    }
+    bigReserve(&res, a->size + b->size);
+    memset(res.limbs, 0, sizeof(uint32_t) * (a->size + b->size));
+    for (long i = 0; i < a->size; ++i) {
+        uint64_t carry = 0;
+        uint64_t ai = a->limbs[i];
+        for (long j = 0; j < b->size; ++j) {
+            carry += ai * b->limbs[j] + res.limbs[i + j];
+            res.limbs[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        res.limbs[i + b->size] = (uint32_t)carry;
+    }
+    res.size = a->size + b->size;
+    res.negative = a->negative != b->negative;
+    bigTrim(&res);
+    bigSwap(r, &res);
+    bigFree(&res);
+}
+
+static inline void bigMulSmall(bigInt *a, uint32_t m) {
+    uint64_t carry = 0;
+    for (long i = 0; i < a->size; ++i) {
+        carry += (uint64_t)a->limbs[i] * m;
+        a->limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry != 0) {
+        bigReserve(a, a->size + 1);
+        a->limbs[a->size++] = (uint32_t)carry;
+    }
+    bigTrim(a);
+}
+
+/*
+ * Divides magnitude of a by d in place, returns the remainder
+ */
+static inline uint32_t bigDivSmall(bigInt *a, uint32_t d) {
+    uint64_t rem = 0;
+    for (long i = a->size - 1; i >= 0; --i) {
+        rem = (rem << 32) | a->limbs[i];
+        a->limbs[i] = (uint32_t)(rem / d);
+        rem %= d;
+    }
+    bigTrim(a);
+    return (uint32_t)rem;
+}
+
+/*
+ * q = floor(|u| / |v|), Knuth's algorithm D
+ */
+static inline void bigDivAbs(bigInt *q, const bigInt *u, const bigInt *v) {
+    if (bigCmpAbs(u, v) < 0) {
+        q->size = 0;
+        q->negative = 0;
+        return;
+    }
+    if (v->size == 1) {
+        bigCopy(q, u);
+        q->negative = 0;
+        bigDivSmall(q, v->limbs[0]);
+        return;
+    }
+
+    long n = v->size, m = u->size - n;
+    int s = __builtin_clz(v->limbs[n - 1]);
+    uint32_t *vn = malloc(sizeof(uint32_t) * n);
+    uint32_t *un = malloc(sizeof(uint32_t) * (u->size + 1));
+    if (vn == NULL || un == NULL) {
+        fprintf(stderr, "bignum division doesn't fit in memory\n");
+        exit(LAB_BIG_BAD_ALLOC);
+    }
+    for (long i = n - 1; i > 0; --i)
+        vn[i] = (v->limbs[i] << s) | (s ? v->limbs[i - 1] >> (32 - s) : 0);
+    vn[0] = v->limbs[0] << s;
+    un[m + n] = s ? u->limbs[m + n - 1] >> (32 - s) : 0;
+    for (long i = m + n - 1; i > 0; --i)
+        un[i] = (u->limbs[i] << s) | (s ? u->limbs[i - 1] >> (32 - s) : 0);
+    un[0] = u->limbs[0] << s;
+
+    bigInt res;
+    bigInit(&res);
+    bigReserve(&res, m + 1);
+    const uint64_t base = 1ULL << 32;
+    for (long j = m; j >= 0; --j) {
+        uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= base) break;
+        }
+
+        int64_t k = 0, t;
+        for (long i = 0; i < n; ++i) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - k - (int64_t)(p & 0xFFFFFFFFULL);
+            un[i + j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + n] - k;
+        un[j + n] = (uint32_t)t;
+
+        if (t < 0) {
+            qhat--;
+            uint64_t carry = 0;
+            for (long i = 0; i < n; ++i) {
+                carry += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            un[j + n] += (uint32_t)carry;
+        }
+        res.limbs[j] = (uint32_t)qhat;
+    }
+    res.size = m + 1;
+    bigTrim(&res);
+    bigSwap(q, &res);
+    bigFree(&res);
+    free(vn);
+    free(un);
+}
+
+static inline void bigPow10(bigInt *r, long e) {
+    bigSetU64(r, 1);
+    for (; e >= 9; e -= 9) bigMulSmall(r, 1000000000U);
+    for (; e > 0; --e) bigMulSmall(r, 10);
+}
+
+/*
+ * r = floor(sqrt(n)) by Newton iterations from a power of two above the root
+ */
+static inline void bigIsqrt(bigInt *r, const bigInt *n) {
+    if (bigIsZero(n)) {
+        r->size = 0;
+        return;
+    }
+    long bits = (n->size - 1) * 32 + (32 - __builtin_clz(n->limbs[n->size - 1]));
+    long half = (bits + 1) / 2;
+
+    bigInt x, y;
+    bigInit(&x);
+    bigInit(&y);
+    bigReserve(&x, half / 32 + 1);
+    memset(x.limbs, 0, sizeof(uint32_t) * (half / 32 + 1));
+    x.limbs[half / 32] = 1U << (half % 32);
+    x.size = half / 32 + 1;
+
+    for (;;) {
+        bigDivAbs(&y, n, &x);
+        bigAddAbs(&y, &y, &x);
+        bigDivSmall(&y, 2);
+        if (bigCmpAbs(&y, &x) >= 0) break;
+        bigSwap(&x, &y);
+    }
+    bigSwap(r, &x);
+    bigFree(&x);
+    bigFree(&y);
+}
+
+/*
+ * Returns decimal digits of |a|, caller frees the result
+ */
+static inline char *bigToDecimal(const bigInt *a) {
+    bigInt t;
+    bigInit(&t);
+    bigCopy(&t, a);
+    long chunks = 0;
+    uint32_t *parts = malloc(sizeof(uint32_t) * (a->size * 32 / 29 + 2));
+    char *res = malloc(a->size * 10 + 2);
+    if (parts == NULL || res == NULL) {
+        fprintf(stderr, "can't allocate decimal digits\n");
+        exit(LAB_BIG_BAD_ALLOC);
+    }
+    do {
+        parts[chunks++] = bigDivSmall(&t, 1000000000U);
+    } while (!bigIsZero(&t));
+
+    long len = sprintf(res, "%u", parts[chunks - 1]);
+    for (long i = chunks - 2; i >= 0; --i) len += sprintf(res + len, "%09u", parts[i]);
+    free(parts);
+    bigFree(&t);
+    return res;
+}
+
+/*
+ * Formats pi * 10^(digits + guard) as "3.14..." rounded to digits significant
+ * digits, like printWide. The carry never reaches the leading 3.
+ */
+static inline char *formatPiDigits(const bigInt *scaled, long digits) {
+    char *decimal = bigToDecimal(scaled);
+    char *res = malloc(digits + 2);
+    if (res == NULL) {
+        fprintf(stderr, "can't allocate decimal digits\n");
+        exit(LAB_BIG_BAD_ALLOC);
+    }
+    if (decimal[digits] >= '5') {
+        long i = digits - 1;
+        while (i > 0 && decimal[i] == '9') decimal[i--] = '0';
+        decimal[i]++;
+    }
+    res[0] = decimal[0];
+    if (digits > 1) {
+        res[1] = '.';
+        memcpy(res + 2, decimal + 1, digits - 1);
+        res[digits + 1] = '\0';
+    } else {
+        res[1] = '\0';
+    }
+    free(decimal);
+    return res;
+}
+
+typedef struct _machinJob {
+    const bigInt *unity;
+    long first;
+    long stride;
+    bigInt sum5;
+    bigInt sum239;
+} machinJob;
+
+/*
+ * sum += sum over k = first, first + stride... of (-1)^k * unity / ((2k+1) * x^(2k+1))
+ */
+static inline void arctanPart(bigInt *sum, uint32_t x, const bigInt *unity, long first, long stride) {
+    bigInt power, term;
+    bigInit(&power);
+    bigInit(&term);
+    bigCopy(&power, unity);
+    for (long i = 0; i < 2 * first + 1; ++i) bigDivSmall(&power, x);
+
+    for (long k = first; !bigIsZero(&power); k += stride) {
+        bigCopy(&term, &power);
+        bigDivSmall(&term, (uint32_t)(2 * k + 1));
+        if (k % 2 == 0) bigAdd(sum, sum, &term);
+        else bigSub(sum, sum, &term);
+        for (long i = 0; i < stride && !bigIsZero(&power); ++i) bigDivSmall(&power, x * x);
+    }
+    bigFree(&power);
+    bigFree(&term);
+}
+
+static inline void * machinWorker(void *param) {
+    machinJob *job = (machinJob*)param;
+    arctanPart(&job->sum5, 5, job->unity, job->first, job->stride);
+    arctanPart(&job->sum239, 239, job->unity, job->first, job->stride);
+    return param;
+}
+
+/*
+ * pi = 16 arctan(1/5) - 4 arctan(1/239), thread i sums terms i, i + threads...
+ * of both series. Returns "3.14..." or NULL if threads can't be started.
+ */
+static inline char *machinPi(long threads, long digits) {
+    bigInt unity;
+    bigInit(&unity);
+    bigPow10(&unity, digits + LAB_BIG_GUARD_DIGITS);
+
+    machinJob *jobs = malloc(sizeof(machinJob) * threads);
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+    if (jobs == NULL || ids == NULL) {
+        fprintf(stderr, "can't allocate machin jobs\n");
+        exit(LAB_BIG_BAD_ALLOC);
+    }
+
+    long started = 0;
+    for (long i = 0; i < threads; ++i) {
+        jobs[i].unity = &unity;
+        jobs[i].first = i;
+        jobs[i].stride = threads;
+        bigInit(&jobs[i].sum5);
+        bigInit(&jobs[i].sum239);
+    }
+    for (; started < threads; ++started)
+        if (pthread_create(&ids[started], NULL, machinWorker, &jobs[started]) != 0) break;
+    for (long i = 0; i < started; ++i) pthread_join(ids[i], NULL);
+
+    char *res = NULL;
+    if (started == threads) {
+        bigInt sum5, sum239;
+        bigInit(&sum5);
+        bigInit(&sum239);
+        for (long i = 0; i < threads; ++i) {
+            bigAdd(&sum5, &sum5, &jobs[i].sum5);
+            bigAdd(&sum239, &sum239, &jobs[i].sum239);
+        }
+        bigMulSmall(&sum5, 16);
+        bigMulSmall(&sum239, 4);
+        bigSub(&sum5, &sum5, &sum239);
+        res = formatPiDigits(&sum5, digits);
+        bigFree(&sum5);
+        bigFree(&sum239);
+    }
+
+    for (long i = 0; i < threads; ++i) {
+        bigFree(&jobs[i].sum5);
+        bigFree(&jobs[i].sum239);
+    }
+    free(jobs);
+    free(ids);
+    bigFree(&unity);
+    return res;
+}
+
+#define LAB_CHUDNOVSKY_DIGITS_PER_TERM 14.181647462725477
+
+typedef struct _chudnovskySplit {
+    long a;
+    long b;
+    bigInt P;
+    bigInt Q;
+    bigInt T;
+} chudnovskySplit;
+
+static inline void chudnovskyInit(chudnovskySplit *s, long a, long b) {
+    s->a = a;
+    s->b = b;
+    bigInit(&s->P);
+    bigInit(&s->Q);
+    bigInit(&s->T);
+}
+
+static inline void chudnovskyFree(chudnovskySplit *s) {
+    bigFree(&s->P);
+    bigFree(&s->Q);
+    bigFree(&s->T);
+}
+
+/*
+ * Joins adjacent ranges [l.a, l.b) and [r.a, r.b) into l
+ */
+static inline void chudnovskyCombine(chudnovskySplit *l, chudnovskySplit *r) {
+    bigInt t;
+    bigInit(&t);
+    bigMul(&l->T, &l->T, &r->Q);
+    bigMul(&t, &l->P, &r->T);
+    bigAdd(&l->T, &l->T, &t);
+    bigMul(&l->P, &l->P, &r->P);
+    bigMul(&l->Q, &l->Q, &r->Q);
+    l->b = r->b;
+    bigFree(&t);
+}
+
+static inline void chudnovskyRange(chudnovskySplit *s) {
+    long a = s->a, b = s->b;
+    if (b - a == 1) {
+        if (a == 0) {
+            bigSetU64(&s->P, 1);
+            bigSetU64(&s->Q, 1);
+        } else {
+            bigSetU64(&s->P, 6 * a - 5);
+            bigMulSmall(&s->P, (uint32_t)(2 * a - 1));
+            bigMulSmall(&s->P, (uint32_t)(6 * a - 1));
+            // a^3 * 640320^3 / 24
+            bigSetU64(&s->Q, a);
+            bigMulSmall(&s->Q, (uint32_t)a);
+            bigMulSmall(&s->Q, (uint32_t)a);
+            bigMulSmall(&s->Q, 26680);
+            bigMulSmall(&s->Q, 640320);
+            bigMulSmall(&s->Q, 640320);
+        }
+        bigInt linear;
+        bigInit(&linear);
+        bigSetU64(&linear, 13591409ULL + 545140134ULL * a);
+        bigMul(&s->T, &s->P, &linear);
+        if (a % 2 == 1) s->T.negative = 1;
+        bigFree(&linear);
+        return;
+    }
+
+    chudnovskySplit right;
+    long m = (a + b) / 2;
+    s->b = m;
+    chudnovskyInit(&right, m, b);
+    chudnovskyRange(s);
+    chudnovskyRange(&right);
+    chudnovskyCombine(s, &right);
+    chudnovskyFree(&right);
+}
+
+static inline void * chudnovskyWorker(void *param) {
+    chudnovskyRange((chudnovskySplit*)param);
+    return param;
+}
+
+typedef struct _chudnovskyPair {
+    chudnovskySplit *l;
+    chudnovskySplit *r;
+} chudnovskyPair;
+
+static inline void * chudnovskyCombineWorker(void *param) {
+    chudnovskyPair *pair = (chudnovskyPair*)param;
+    chudnovskyCombine(pair->l, pair->r);
+    return param;
+}
+
+/*
+ * Runs f over args[0..count) on own threads, returns 0 if some thread couldn't start
+ */
+static inline int bigRunParallel(void *(*f)(void*), void *args, size_t argSize, long count) {
+    pthread_t *ids = malloc(sizeof(pthread_t) * count);
+    if (ids == NULL) return 0;
+    long started = 0;
+    for (; started < count; ++started)
+        if (pthread_create(&ids[started], NULL, f, (char*)args + argSize * started) != 0) break;
+    for (long i = 0; i < started; ++i) pthread_join(ids[i], NULL);
+    free(ids);
+    return started == count;
+}
+
+/*
+ * pi = 426880 sqrt(10005) Q(0, N) / T(0, N). Every thread splits its own range of terms,
+ * ranges are then joined pairwise in parallel.
+ * Returns "3.14..." or NULL if threads can't be started.
+ */
+static inline char *chudnovskyPi(long threads, long digits) {
+    long terms = (long)(digits / LAB_CHUDNOVSKY_DIGITS_PER_TERM) + 2;
+    if (threads > terms) threads = terms;
+
+    chudnovskySplit *splits = malloc(sizeof(chudnovskySplit) * threads);
+    chudnovskySplit **live = malloc(sizeof(chudnovskySplit*) * threads);
+    chudnovskyPair *pairs = malloc(sizeof(chudnovskyPair) * (threads / 2 + 1));
+    if (splits == NULL || live == NULL || pairs == NULL) {
+        fprintf(stderr, "can't allocate chudnovsky ranges\n");
+        exit(LAB_BIG_BAD_ALLOC);
+    }
+    for (long i = 0; i < threads; ++i) {
+        chudnovskyInit(&splits[i], terms * i / threads, terms * (i + 1) / threads);
+        live[i] = &splits[i];
+    }
+
+    int ok = bigRunParallel(chudnovskyWorker, splits, sizeof(chudnovskySplit), threads);
+    for (long count = threads; ok && count > 1; count = (count + 1) / 2) {
+        for (long i = 0; i < count / 2; ++i) pairs[i] = (chudnovskyPair){live[2 * i], live[2 * i + 1]};
+        ok = bigRunParallel(chudnovskyCombineWorker, pairs, sizeof(chudnovskyPair), count / 2);
+        for (long i = 0; i < (count + 1) / 2; ++i) live[i] = live[2 * i];
+    }
+
+    char *res = NULL;
+    if (ok) {
+        bigInt root, pi;
+        bigInit(&root);
+        bigInit(&pi);
+        long scale = digits + LAB_BIG_GUARD_DIGITS;
+        bigPow10(&pi, 2 * scale);
+        bigMulSmall(&pi, 10005);
+        bigIsqrt(&root, &pi);
+        bigMul(&pi, &live[0]->Q, &root);
+        bigMulSmall(&pi, 426880);
+        bigDivAbs(&pi, &pi, &live[0]->T);
+        res = formatPiDigits(&pi, digits);
+        bigFree(&root);
+        bigFree(&pi);
+    }
+
+    for (long i = 0; i < threads; ++i) chudnovskyFree(&splits[i]);
+    free(splits);
+    free(live);
+    free(pairs);
+    return res;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef LAB_CACHE_H
+#define LAB_CACHE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "labpi.h"
+
+#define LAB_CACHE_MAGIC "labpisc1"
+
+/*
+ * Compensated sums of the first blocks blocks of block indexes each,
+ * one file per kernel and simd level since their lanes round differently.
+ * Sums are appended and synced before blocks grows, so a crash never leaves
+ * a counted block unwritten.
+ */
+typedef struct _sumCacheHeader {
+    char magic[8];
+    int kernel;
+    int simd;
+    long block;
+    long blocks;
+} sumCacheHeader;
+
+typedef struct _sumCache {
+    char path[PATH_MAX];
+    int fd;
+    sumCacheHeader *header;
+    size_t size;
+} sumCache;
+
+static inline double *cachedSums(sumCache *c) {
+    return (double *)(c->header + 1);
+}
+
+static inline int mapSumCache(sumCache *c, size_t size) {
+    if (c->header != NULL) munmap(c->header, c->size);
+    c->header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if (c->header == MAP_FAILED) {
+        c->header = NULL;
+        return errno;
+    }
+    c->size = size;
+    return 0;
+}
+
+static inline void closeSumCache(sumCache *c) {
+    if (c->header != NULL) munmap(c->header, c->size);
+    if (c->fd >= 0) close(c->fd); // releases the lock
+    c->header = NULL;
+    c->fd = -1;
+}
+
+/*
+ * Opens or creates base.kernel.simd and holds an exclusive lock on it until closed,
+ * so concurrent runs extend it one after another. Returns 0 or errno,
+ * EINVAL if the file is not a cache of this block size.
+ */
+static inline int openSumCache(sumCache *c, const char *base, int kernel, int simd, long block) {
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    if (snprintf(c->path, sizeof(c->path), "%s.%s.%s", base, kernels[kernel].name, simdNames[simd]) >= (int)sizeof(c->path))
+        return ENAMETOOLONG;
+
+    c->fd = open(c->path, O_RDWR | O_CREAT, 0644);
+    if (c->fd < 0) return errno;
+    struct stat st;
+    if (flock(c->fd, LOCK_EX) != 0 || fstat(c->fd, &st) != 0) {
+        int code = errno;
+        closeSumCache(c);
+        return code;
+    }
+
+    int code = 0;
+    if (st.st_size == 0) {
+        if (ftruncate(c->fd, sizeof(sumCacheHeader)) != 0 || (code = mapSumCache(c, sizeof(sumCacheHeader))) != 0) {
+            code = code ? code : errno;
+        } else {
+            memcpy(c->header->magic, LAB_CACHE_MAGIC, sizeof(c->header->magic));
+            c->header->kernel = kernel;
+            c->header->simd = simd;
+            c->header->block = block;
+            c->header->blocks = 0;
+        }
+    } else if ((size_t)st.st_size < sizeof(sumCacheHeader)) {
+        code = EINVAL;
+    } else if ((code = mapSumCache(c, st.st_size)) == 0) {
+        sumCacheHeader *h = c->header;
+        if (memcmp(h->magic, LAB_CACHE_MAGIC, sizeof(h->magic)) != 0 || h->kernel != kernel || h->simd != simd
+                || h->block != block || h->blocks < 0 || sizeof(sumCacheHeader) + h->blocks * sizeof(double) > (size_t)st.st_size)
+            code = EINVAL;
+    }
+    if (code != 0) closeSumCache(c);
+    return code;
+}
+
+/*
+ * Appends sums[header->blocks, blocks) to the cache
+ */
+static inline int extendSumCache(sumCache *c, const double *sums, long blocks) {
+    long from = c->header->blocks;
+    if (blocks <= from) return 0;
+
+    size_t size = sizeof(sumCacheHeader) + blocks * sizeof(double);
+    int code;
+    if (size > c->size) {
+        if (ftruncate(c->fd, size) != 0) return errno;
+        if ((code = mapSumCache(c, size)) != 0) return code;
+    }
+    memcpy(cachedSums(c) + from, sums + from, (blocks - from) * sizeof(double));
+    if (msync(c->header, c->size, MS_SYNC) != 0) return errno;
+    c->header->blocks = blocks;
+    if (msync(c->header, c->size, MS_SYNC) != 0) return errno;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef LAB_CHECKPOINT_H
+#define LAB_CHECKPOINT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LAB_CHECKPOINT_MAGIC "labpick1"
+
+/*
+ * State file of an interleaved block run: blocks are numbered from 0, every block
+ * is range terms, worker j of threads owns blocks base + j + k * threads.
+ * All blocks below base are summed into baseSum, worker j has done its first
+ * slots[j].blocks blocks and their sum is slots[j].sum.
+ *
+ * The file keeps two copies of the slots. A checkpoint is written into the copy
+ * that is not active and synced, only then active is flipped, so a crash at any
+ * point leaves the previous checkpoint intact.
+ */
+typedef struct _checkpointSlot {
+    double blocks;
+    double sum;
+} checkpointSlot;
+
+typedef struct _checkpointHeader {
+    char magic[8];
+    long range;
+    long threads;
+    double base;
+    double baseSum;
+    long active;
+    long generation;
+} checkpointHeader;
+
+typedef struct _checkpointFile {
+    char path[PATH_MAX];
+    char tmpPath[PATH_MAX];
+    checkpointHeader *header;
+    size_t size;
+    int published; // tmpPath was renamed to path
+} checkpointFile;
+
+/*
+ * Contents of the last complete checkpoint, threads is 0 for a fresh run
+ */
+typedef struct _checkpointState {
+    long range;
+    long threads;
+    double base;
+    double baseSum;
+    checkpointSlot *slots;
+} checkpointState;
+
+static inline size_t checkpointSize(long threads) {
+    return sizeof(checkpointHeader) + 2 * threads * sizeof(checkpointSlot);
+}
+
+static inline checkpointSlot *checkpointCopy(checkpointHeader *header, long copy) {
+    return (checkpointSlot *)(header + 1) + copy * header->threads;
+}
+
+/*
+ * Returns 0 or errno, EINVAL if the file is not a checkpoint
+ */
+static inline int loadCheckpoint(const char *path, checkpointState *state) {
+    memset(state, 0, sizeof(*state));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(checkpointHeader)) {
+        close(fd);
+        return EINVAL;
+    }
+    checkpointHeader *header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) return errno;
+
+    int code = 0;
+    if (memcmp(header->magic, LAB_CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 || header->threads <= 0
+            || (size_t)st.st_size != checkpointSize(header->threads) || (header->active & ~1L) != 0) {
+        code = EINVAL;
+    } else if ((state->slots = malloc(sizeof(checkpointSlot) * header->threads)) == NULL) {
+        code = ENOMEM;
+    } else {
+        state->range = header->range;
+        state->threads = header->threads;
+        state->base = header->base;
+        state->baseSum = header->baseSum;
+        memcpy(state->slots, checkpointCopy(header, header->active), sizeof(checkpointSlot) * header->threads);
+    }
+    munmap(header, st.st_size);
+    return code;
+}
+
+static inline void freeCheckpointState(checkpointState *state) {
+    free(state->slots);
+    state->slots = NULL;
+}
+
+/*
+ * First block index past the work of worker j
+ */
+static inline double checkpointNext(const checkpointState *state, long j) {
+    return state->base + j + state->slots[j].blocks * state->threads;
+}
+
+/*
+ * Every block below *from is done, no block from *to on is done
+ */
+static inline void checkpointFrontier(const checkpointState *state, double *from, double *to) {
+    *from = *to = state->base;
+    for (long j = 0; j < state->threads; ++j) {
+        double next = checkpointNext(state, j);
+        if (j == 0 || next < *from) *from = next;
+        if (next > *to) *to = next;
+    }
+}
+
+static inline int checkpointHasBlock(const checkpointState *state, double block) {
+    if (block < state->base) return 1;
+    double k = block - state->base;
+    long j = (long)fmod(k, state->threads);
+    return floor(k / state->threads) < state->slots[j].blocks;
+}
+
+static inline double checkpointSum(const checkpointState *state) {
+    double sum = state->baseSum;
+    for (long j = 0; j < state->threads; ++j) sum += state->slots[j].sum;
+    return sum;
+}
+
+/*
+ * Creates path.tmp with empty slots; it replaces path on the first commit,
+ * so the checkpoint a run resumed from stays valid until this one is complete
+ */
+static inline int createCheckpoint(checkpointFile *cp, const char *path, long range, long threads, double base, double baseSum) {
+    memset(cp, 0, sizeof(*cp));
+    if (snprintf(cp->path, sizeof(cp->path), "%s", path) >= (int)sizeof(cp->path)
+            || snprintf(cp->tmpPath, sizeof(cp->tmpPath), "%s.tmp", path) >= (int)sizeof(cp->tmpPath))
+        return ENAMETOOLONG;
+
+    int fd = open(cp->tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return errno;
+    cp->size = checkpointSize(threads);
+    if (ftruncate(fd, cp->size) != 0) {
+        int code = errno;
+        close(fd);
+        return code;
+    }
+    cp->header = mmap(NULL, cp->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cp->header == MAP_FAILED) {
+        cp->header = NULL;
+        return errno;
+    }
+
+    memcpy(cp->header->magic, LAB_CHECKPOINT_MAGIC, sizeof(cp->header->magic));
+    cp->header->range = range;
+    cp->header->threads = threads;
+    cp->header->base = base;
+    cp->header->baseSum = baseSum;
+    return 0;
+}
+
+/*
+ * Slots to fill before commitCheckpoint()
+ */
+static inline checkpointSlot *nextCheckpoint(checkpointFile *cp) {
+    return checkpointCopy(cp->header, 1 - cp->header->active);
+}
+
+static inline int commitCheckpoint(checkpointFile *cp) {
+    if (msync(cp->header, cp->size, MS_SYNC) != 0) return errno;
+    __atomic_store_n(&cp->header->active, 1 - cp->header->active, __ATOMIC_RELEASE);
+    cp->header->generation++;
+    if (msync(cp->header, cp->size, MS_SYNC) != 0) return errno;
+    if (!cp->published) {
+        if (rename(cp->tmpPath, cp->path) != 0) return errno;
+        cp->published = 1;
+    }
+    return 0;
+}
+
+static inline void closeCheckpoint(checkpointFile *cp) {
+    if (cp->header != NULL) munmap(cp->header, cp->size);
+    if (!cp->published) unlink(cp->tmpPath);
+    cp->header = NULL;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef LAB_CPU_H
+#define LAB_CPU_H
+
+/*
+ * Needs _GNU_SOURCE defined before the first include of the program
+ * for CPU_SET and pthread_setaffinity_np
+ */
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define LAB_AFFINITY_NONE 0
+#define LAB_AFFINITY_CORE 1
+#define LAB_AFFINITY_SPREAD 2
+
+#define LAB_MAX_NODES 64
+
+typedef struct _labCpu {
+    int id;
+    int package;
+    int core;
+    int node;
+    int rank; // position in the order cpus are handed out
+} labCpu;
+
+static inline long readLongFromFile(const char *path, long fallback) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return fallback;
+    long v;
+    if (fscanf(f, "%ld", &v) != 1) v = fallback;
+    fclose(f);
+    return v;
+}
+
+static inline int readCpuTopology(int cpu, const char *what) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, what);
+    return (int)readLongFromFile(path, 0);
+}
+
+static inline int readCpuNode(int cpu) {
+    char path[128];
+    for (int node = 0; node < LAB_MAX_NODES; ++node) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0) return node;
+    }
+    return 0;
+}
+
+/*
+ * Returns cpus the cgroup lets us use in full, or 0 if there is no quota
+ */
+static inline long cgroupCpuQuota() {
+    FILE *f = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (f != NULL) {
+        char quota[32];
+        long period = 0;
+        int read = fscanf(f, "%31s %ld", quota, &period);
+        fclose(f);
+        if (read == 2 && strcmp(quota, "max") != 0 && period > 0)
+            return (strtol(quota, NULL, 10) + period - 1) / period;
+        return 0;
+    }
+
+    long quota = readLongFromFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", -1);
+    long period = readLongFromFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us", 0);
+    if (quota <= 0 || period <= 0) return 0;
+    return (quota + period - 1) / period;
+}
+
+/*
+ * Number of cpus this process may run on, limited by affinity mask and cgroup quota
+ */
+static inline long availableCpus() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) cpus = CPU_COUNT(&set);
+
+    long quota = cgroupCpuQuota();
+    if (quota > 0 && quota < cpus) cpus = quota;
+    return cpus > 0 ? cpus : 1;
+}
+
+static inline int compareCpuRank(const void *a, const void *b) {
+    const labCpu *l = a, *r = b;
+    if (l->rank != r->rank) return l->rank < r->rank ? -1 : 1;
+    return l->id - r->id;
+}
+
+/*
+ * Returns allowed cpus in the order workers should be pinned to them:
+ * LAB_AFFINITY_CORE gives one cpu of every physical core before any SMT sibling,
+ * LAB_AFFINITY_SPREAD additionally alternates NUMA nodes.
+ * Caller frees the result.
+ */
+static inline labCpu *planAffinity(int mode, int *count) {
+    cpu_set_t set;
+    *count = 0;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return NULL;
+
+    labCpu *cpus = malloc(sizeof(labCpu) * CPU_COUNT(&set));
+    if (cpus == NULL) return NULL;
+
+    int n = 0;
+    for (int id = 0; id < CPU_SETSIZE && n < CPU_COUNT(&set); ++id) {
+        if (!CPU_ISSET(id, &set)) continue;
+        labCpu c = {id, readCpuTopology(id, "physical_package_id"), readCpuTopology(id, "core_id"), readCpuNode(id), 0};
+        cpus[n++] = c;
+    }
+
+    int sibling[n];
+    for (int i = 0; i < n; ++i) {
+        sibling[i] = 0;
+        for (int j = 0; j < i; ++j)
+            if (cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core) sibling[i]++;
+    }
+
+    // SMT siblings go last; within one sibling level spread mode interleaves nodes
+    for (int i = 0; i < n; ++i) {
+        int inNode = 0;
+        for (int j = 0; j < i; ++j)
+            if (cpus[j].node == cpus[i].node && sibling[j] == sibling[i]) inNode++;
+        cpus[i].rank = mode == LAB_AFFINITY_SPREAD ? (sibling[i] * CPU_SETSIZE + inNode) * LAB_MAX_NODES + cpus[i].node
+                                                   : sibling[i] * CPU_SETSIZE + i;
+    }
+
+    qsort(cpus, n, sizeof(labCpu), compareCpuRank);
+    *count = n;
+    return cpus;
+}
+
+static inline int pinThreadToCpu(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+#endif
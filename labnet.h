@@ -0,0 +1,221 @@
+#ifndef LAB_NET_H
+#define LAB_NET_H
+
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Coordinator/worker protocol for summing the series across processes.
+ * Every message is an 8 byte header followed by count records,
+ * integers are big-endian and doubles are sent as their IEEE bits:
+ *
+ *   u8 type, u8 kernel, u16 reserved, u32 count
+ *
+ *   HELLO      worker -> coordinator, count = worker threads, no records,
+ *              answered with count = heartbeat interval in milliseconds
+ *   ASSIGN     coordinator -> worker, count ranges of u64 first index, u64 indexes
+ *   RESULT     worker -> coordinator, count ranges of u64 first index, u64 indexes, f64 sum
+ *   HEARTBEAT  worker -> coordinator, no records
+ *   DONE       coordinator -> worker, no records, the worker exits
+ */
+#define LAB_NET_HELLO 1
+#define LAB_NET_ASSIGN 2
+#define LAB_NET_RESULT 3
+#define LAB_NET_HEARTBEAT 4
+#define LAB_NET_DONE 5
+
+#define LAB_NET_HEADER 8
+#define LAB_NET_MAX_BATCH 4096 // ranges in one message
+#define LAB_NET_MISSED_HEARTBEATS 4 // intervals of silence after which a worker is dead
+
+typedef struct _netHeader {
+    int type;
+    int kernel;
+    uint32_t count;
+} netHeader;
+
+typedef struct _netRange {
+    uint64_t first;
+    uint64_t count;
+    double sum;
+} netRange;
+
+static inline size_t netRecordSize(int type) {
+    return type == LAB_NET_ASSIGN ? 16 : type == LAB_NET_RESULT ? 24 : 0;
+}
+
+static inline int writeAll(int fd, const void *buf, size_t size) {
+    const char *p = buf;
+    while (size > 0) {
+        ssize_t w = send(fd, p, size, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return w < 0 ? errno : EPIPE;
+        p += w;
+        size -= w;
+    }
+    return 0;
+}
+
+/*
+ * Returns 0, errno or ECONNRESET if the peer closed the connection
+ */
+static inline int readAll(int fd, void *buf, size_t size) {
+    char *p = buf;
+    while (size > 0) {
+        ssize_t r = read(fd, p, size);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return r < 0 ? errno : ECONNRESET;
+        p += r;
+        size -= r;
+    }
+    return 0;
+}
+
+static inline void netPut64(unsigned char *p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, 8);
+}
+
+static inline uint64_t netGet64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return be64toh(v);
+}
+
+/*
+ * Sends a message with count ranges in one write, records as netRecordSize(type)
+ */
+static inline int netSend(int fd, int type, int kernel, uint32_t count, const netRange *ranges) {
+    size_t record = netRecordSize(type);
+    size_t size = LAB_NET_HEADER + (record ? count * record : 0);
+    unsigned char stack[LAB_NET_HEADER + 64 * 24];
+    unsigned char *buf = size <= sizeof(stack) ? stack : malloc(size);
+    if (buf == NULL) return ENOMEM;
+
+    uint32_t c = htobe32(count);
+    buf[0] = (unsigned char)type;
+    buf[1] = (unsigned char)kernel;
+    buf[2] = buf[3] = 0;
+    memcpy(buf + 4, &c, 4);
+    for (uint32_t i = 0; record && i < count; ++i) {
+        unsigned char *r = buf + LAB_NET_HEADER + i * record;
+        netPut64(r, ranges[i].first);
+        netPut64(r + 8, ranges[i].count);
+        if (type == LAB_NET_RESULT) {
+            uint64_t bits;
+            memcpy(&bits, &ranges[i].sum, 8);
+            netPut64(r + 16, bits);
+        }
+    }
+    int code = writeAll(fd, buf, size);
+    if (buf != stack) free(buf);
+    return code;
+}
+
+static inline int netRecvHeader(int fd, netHeader *h) {
+    unsigned char buf[LAB_NET_HEADER];
+    int code = readAll(fd, buf, sizeof(buf));
+    if (code != 0) return code;
+    uint32_t c;
+    memcpy(&c, buf + 4, 4);
+    h->type = buf[0];
+    h->kernel = buf[1];
+    h->count = be32toh(c);
+    if (h->type < LAB_NET_HELLO || h->type > LAB_NET_DONE || (netRecordSize(h->type) && h->count > LAB_NET_MAX_BATCH))
+        return EPROTO;
+    return 0;
+}
+
+/*
+ * Reads the h->count records that follow the header into ranges
+ */
+static inline int netRecvRanges(int fd, const netHeader *h, netRange *ranges) {
+    size_t record = netRecordSize(h->type);
+    if (record == 0 || h->count == 0) return 0;
+    unsigned char *buf = malloc(h->count * record);
+    if (buf == NULL) return ENOMEM;
+    int code = readAll(fd, buf, h->count * record);
+    for (uint32_t i = 0; code == 0 && i < h->count; ++i) {
+        unsigned char *r = buf + i * record;
+        ranges[i].first = netGet64(r);
+        ranges[i].count = netGet64(r + 8);
+        ranges[i].sum = 0;
+        if (h->type == LAB_NET_RESULT) {
+            uint64_t bits = netGet64(r + 16);
+            memcpy(&ranges[i].sum, &bits, 8);
+        }
+    }
+    free(buf);
+    return code;
+}
+
+/*
+ * Opens a listening (listening != 0) or connected socket for
+ * unix:/path, tcp:port (localhost) or tcp:host:port. Returns fd or -errno.
+ */
+static inline int netOpen(const char *address, int listening) {
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) return -ENAMETOOLONG;
+        strcpy(addr.sun_path, address + 5);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -errno;
+        if (listening) unlink(addr.sun_path);
+        int rc = listening ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) : connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        if (rc == 0 && listening) rc = listen(fd, SOMAXCONN);
+        if (rc != 0) {
+            int code = errno;
+            close(fd);
+            return -code;
+        }
+        return fd;
+    }
+    if (strncmp(address, "tcp:", 4) != 0) return -EINVAL;
+
+    char host[256] = "127.0.0.1";
+    const char *port = address + 4;
+    const char *colon = strrchr(port, ':');
+    if (colon != NULL) {
+        if ((size_t)(colon - port) >= sizeof(host)) return -ENAMETOOLONG;
+        memcpy(host, port, colon - port);
+        host[colon - port] = 0;
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *list;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &list) != 0) return -EINVAL;
+    int fd = -EADDRNOTAVAIL;
+    for (struct addrinfo *ai = list; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            fd = -errno;
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        int rc = listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) : connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (rc == 0 && listening) rc = listen(fd, SOMAXCONN);
+        if (rc == 0) break;
+        int code = errno;
+        close(fd);
+        fd = -code;
+    }
+    freeaddrinfo(list);
+    return fd;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef LAB_PERF_H
+#define LAB_PERF_H
+
+/*
+ * Hardware counters of one thread through perf_event_open. Every event is
+ * opened on its own, so a kernel or VM that hides some of them still gives
+ * the rest; task-clock is a software event and is counted wherever perf
+ * is allowed at all. Counters left unopened read as -1.
+ *
+ *   perfStart(&c);   // in the thread to count
+ *   ...
+ *   perfStop(&c);
+ *   printPerf(stdout, "thread 0", &c, terms, "term");
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define LAB_PERF_CYCLES 0
+#define LAB_PERF_INSTRUCTIONS 1
+#define LAB_PERF_BRANCH_MISSES 2
+#define LAB_PERF_CACHE_MISSES 3
+#define LAB_PERF_TASK_CLOCK 4 // ns
+#define LAB_PERF_EVENTS 5
+
+static const struct {
+    const char *name;
+    unsigned type;
+    unsigned long long config;
+} perfEvents[LAB_PERF_EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+typedef struct _perfCounters {
+    int fd[LAB_PERF_EVENTS];
+    double value[LAB_PERF_EVENTS]; // scaled up if the event was multiplexed, -1 if not counted
+    int error; // errno of the first event that couldn't be opened
+} perfCounters;
+
+/*
+ * Opens and enables the counters of the calling thread, user space only
+ * so the default perf_event_paranoid setting allows it. errno is kept,
+ * callers that check it after their own calls must not see our failures.
+ */
+static inline void perfStart(perfCounters *c) {
+    int saved = errno;
+    c->error = 0;
+    for (int e = 0; e < LAB_PERF_EVENTS; ++e) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perfEvents[e].type;
+        attr.config = perfEvents[e].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        c->value[e] = -1;
+        c->fd[e] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (c->fd[e] < 0 && c->error == 0) c->error = errno;
+    }
+    for (int e = 0; e < LAB_PERF_EVENTS; ++e)
+        if (c->fd[e] >= 0) ioctl(c->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    errno = saved;
+}
+
+static inline void perfStop(perfCounters *c) {
+    for (int e = 0; e < LAB_PERF_EVENTS; ++e)
+        if (c->fd[e] >= 0) ioctl(c->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+    for (int e = 0; e < LAB_PERF_EVENTS; ++e) {
+        if (c->fd[e] < 0) continue;
+        unsigned long long v[3]; // value, time enabled, time running
+        if (read(c->fd[e], v, sizeof(v)) == (ssize_t)sizeof(v) && v[2] > 0)
+            c->value[e] = v[2] < v[1] ? (double)v[0] * v[1] / v[2] : (double)v[0];
+        close(c->fd[e]);
+        c->fd[e] = -1;
+    }
+}
+
+/*
+ * One line of the counters, IPC and the cost of one unit of work (a term, a round...)
+ */
+static inline void printPerf(FILE *out, const char *label, const perfCounters *c, double units, const char *unit) {
+    int counted = 0;
+    for (int e = 0; e < LAB_PERF_EVENTS; ++e) counted += c->value[e] >= 0;
+    if (counted == 0) {
+        fprintf(out, "perf %s: counters unavailable (%s)\n", label, strerror(c->error));
+        return;
+    }
+
+    fprintf(out, "perf %s:", label);
+    for (int e = 0; e < LAB_PERF_EVENTS; ++e) {
+        if (c->value[e] < 0) fprintf(out, " %s=n/a", perfEvents[e].name);
+        else fprintf(out, " %s=%.0f", perfEvents[e].name, c->value[e]);
+    }
+    double cycles = c->value[LAB_PERF_CYCLES], instructions = c->value[LAB_PERF_INSTRUCTIONS];
+    if (cycles > 0 && instructions >= 0) fprintf(out, " IPC=%.3f", instructions / cycles);
+    if (units > 0) {
+        if (cycles >= 0) fprintf(out, " cycles/%s=%.3g", unit, cycles / units);
+        if (instructions >= 0) fprintf(out, " instructions/%s=%.3g", unit, instructions / units);
+        if (c->value[LAB_PERF_TASK_CLOCK] >= 0) fprintf(out, " ns/%s=%.3g", unit, c->value[LAB_PERF_TASK_CLOCK] / units);
+    }
+    if (counted < LAB_PERF_EVENTS) fprintf(out, " (%s)", strerror(c->error));
+    fprintf(out, "\n");
+}
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef LAB_PI_H
+#define LAB_PI_H
+
+#include <math.h>
+#include <time.h>
+#include <string.h>
+#include <float.h>
+#include <stdio.h>
+
+#include "labbig.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LAB_X86
+#endif
+
+#define LAB_SIMD_AUTO -1
+#define LAB_SIMD_SCALAR 0
+#define LAB_SIMD_SSE2 1
+#define LAB_SIMD_AVX2 2
+#define LAB_SIMD_AVX512 3
+
+#define LAB_KERNEL_LEIBNIZ 0
+#define LAB_KERNEL_PAIRED 1
+#define LAB_KERNEL_MACHIN 2
+#define LAB_KERNEL_CHUDNOVSKY 3
+
+#define LAB_ACC_DOUBLE 0
+#define LAB_ACC_LONG_DOUBLE 1
+#define LAB_ACC_WIDE 2
+
+#define LAB_MAX_CORRECTION 6
+#define LAB_CORRECTION_AUTO -1 // the count of tail terms that needs the fewest terms in all
+
+#define LAB_REDUCTION_BLOCK 16384
+#define LAB_COMPENSATED_STEP 1024
+
+/*
+ * Widest floating type the compiler has, used to accumulate and print
+ * results of target precision runs
+ */
+#ifdef __SIZEOF_FLOAT128__
+typedef __float128 labWide;
+#define LAB_WIDE_NAME "float128"
+#define LAB_WIDE_EPSILON 9.62964972193617926527988971292463659e-35Q
+#define LAB_PI_WIDE 3.14159265358979323846264338327950288Q
+#else
+typedef long double labWide;
+#define LAB_WIDE_NAME "long double"
+#define LAB_WIDE_EPSILON (LDBL_EPSILON / 2)
+#define LAB_PI_WIDE 3.14159265358979323846264338327950288L
+#endif
+
+/*
+ * Sums count indexes of a series starting from index start,
+ * taking every step-th index: start, start + step, start + 2 * step...
+ * start and step must hold integer values.
+ * For the Leibniz kernel an index is one term, for the paired kernel
+ * index k is the pair of terms 2k and 2k+1.
+ */
+typedef double (*leibnizSumFunc)(double start, double step, long count);
+
+static inline double LeibnizPi(double i) {
+    double f = floor(i);
+    return pow(-1, f) / (2*i + 1.0);
+}
+
+static inline double leibnizSign(double i) {
+    return ((long)i & 1) == 0 ? 1.0 : -1.0;
+}
+
+static inline double leibnizSumScalar(double start, double step, long count) {
+    double res = 0;
+    double x = start;
+    for (long i = 0; i < count; ++i) {
+        res += LeibnizPi(x);
+        x += step;
+    }
+    return res;
+}
+
+/*
+ * 1/(4k+1) - 1/(4k+3) = 2/((4k+1)(4k+3)): one division per two terms,
+ * every summand is positive, so there is no sign and no cancellation
+ */
+static inline double pairedSumScalar(double start, double step, long count) {
+    double res = 0;
+    double a = 4 * start + 1.0;
+    double inc = 4 * step;
+    for (long i = 0; i < count; ++i) {
+        res += 2.0 / (a * (a + 2.0));
+        a += inc;
+    }
+    return res;
+}
+
+#ifdef LAB_X86
+/*
+ * Vector kernels keep one term per lane. Every lane moves by (lanes * step) terms,
+ * which is even, so the sign of a lane never changes and is loaded once.
+ * Denominators are kept as 2x+1 and advanced by addition only.
+ */
+__attribute__((target("sse2")))
+static inline double leibnizSumSSE2(double start, double step, long count) {
+    long vectors = count / 2;
+    __m128d sign = _mm_set_pd(leibnizSign(start + step), leibnizSign(start));
+    __m128d denom = _mm_set_pd(2 * (start + step) + 1.0, 2 * start + 1.0);
+    __m128d inc = _mm_set1_pd(4 * step);
+    __m128d acc = _mm_setzero_pd();
+    for (long i = 0; i < vectors; ++i) {
+        acc = _mm_add_pd(acc, _mm_div_pd(sign, denom));
+        denom = _mm_add_pd(denom, inc);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + leibnizSumScalar(start + vectors * 2 * step, step, count - vectors * 2);
+}
+
+__attribute__((target("avx2")))
+static inline double leibnizSumAVX2(double start, double step, long count) {
+    long vectors = count / 4;
+    __m256d sign = _mm256_set_pd(leibnizSign(start + 3 * step), leibnizSign(start + 2 * step),
+                                 leibnizSign(start + step), leibnizSign(start));
+    __m256d denom = _mm256_set_pd(2 * (start + 3 * step) + 1.0, 2 * (start + 2 * step) + 1.0,
+                                  2 * (start + step) + 1.0, 2 * start + 1.0);
+    __m256d inc = _mm256_set1_pd(8 * step);
+    __m256d acc = _mm256_setzero_pd();
+    for (long i = 0; i < vectors; ++i) {
+        acc = _mm256_add_pd(acc, _mm256_div_pd(sign, denom));
+        denom = _mm256_add_pd(denom, inc);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+        leibnizSumScalar(start + vectors * 4 * step, step, count - vectors * 4);
+}
+
+__attribute__((target("avx512f")))
+static inline double leibnizSumAVX512(double start, double step, long count) {
+    long vectors = count / 8;
+    double signs[8], denoms[8];
+    for (int j = 0; j < 8; ++j) {
+        signs[j] = leibnizSign(start + j * step);
+        denoms[j] = 2 * (start + j * step) + 1.0;
+    }
+    __m512d sign = _mm512_loadu_pd(signs);
+    __m512d denom = _mm512_loadu_pd(denoms);
+    __m512d inc = _mm512_set1_pd(16 * step);
+    __m512d acc = _mm512_setzero_pd();
+    for (long i = 0; i < vectors; ++i) {
+        acc = _mm512_add_pd(acc, _mm512_div_pd(sign, denom));
+        denom = _mm512_add_pd(denom, inc);
+    }
+
+    return _mm512_reduce_add_pd(acc) + leibnizSumScalar(start + vectors * 8 * step, step, count - vectors * 8);
+}
+
+__attribute__((target("sse2")))
+static inline double pairedSumSSE2(double start, double step, long count) {
+    long vectors = count / 2;
+    __m128d a = _mm_set_pd(4 * (start + step) + 1.0, 4 * start + 1.0);
+    __m128d inc = _mm_set1_pd(8 * step);
+    __m128d two = _mm_set1_pd(2.0);
+    __m128d acc = _mm_setzero_pd();
+    for (long i = 0; i < vectors; ++i) {
+        acc = _mm_add_pd(acc, _mm_div_pd(two, _mm_mul_pd(a, _mm_add_pd(a, two))));
+        a = _mm_add_pd(a, inc);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + pairedSumScalar(start + vectors * 2 * step, step, count - vectors * 2);
+}
+
+__attribute__((target("avx2")))
+static inline double pairedSumAVX2(double start, double step, long count) {
+    long vectors = count / 4;
+    __m256d a = _mm256_set_pd(4 * (start + 3 * step) + 1.0, 4 * (start + 2 * step) + 1.0,
+                              4 * (start + step) + 1.0, 4 * start + 1.0);
+    __m256d inc = _mm256_set1_pd(16 * step);
+    __m256d two = _mm256_set1_pd(2.0);
+    __m256d acc = _mm256_setzero_pd();
+    for (long i = 0; i < vectors; ++i) {
+        acc = _mm256_add_pd(acc, _mm256_div_pd(two, _mm256_mul_pd(a, _mm256_add_pd(a, two))));
+        a = _mm256_add_pd(a, inc);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+        pairedSumScalar(start + vectors * 4 * step, step, count - vectors * 4);
+}
+
+__attribute__((target("avx512f")))
+static inline double pairedSumAVX512(double start, double step, long count) {
+    long vectors = count / 8;
+    double as[8];
+    for (int j = 0; j < 8; ++j) as[j] = 4 * (start + j * step) + 1.0;
+    __m512d a = _mm512_loadu_pd(as);
+    __m512d inc = _mm512_set1_pd(32 * step);
+    __m512d two = _mm512_set1_pd(2.0);
+    __m512d acc = _mm512_setzero_pd();
+    for (long i = 0; i < vectors; ++i) {
+        acc = _mm512_add_pd(acc, _mm512_div_pd(two, _mm512_mul_pd(a, _mm512_add_pd(a, two))));
+        a = _mm512_add_pd(a, inc);
+    }
+
+    return _mm512_reduce_add_pd(acc) + pairedSumScalar(start + vectors * 8 * step, step, count - vectors * 8);
+}
+#endif
+
+/*
+ * Sums count indexes from start in runs of LAB_COMPENSATED_STEP with sum,
+ * adding the runs with Neumaier compensation. The result depends only on start and count.
+ */
+static inline double compensatedSum(leibnizSumFunc sum, double start, long count) {
+    double res = 0, c = 0;
+    for (long i = 0; i < count; i += LAB_COMPENSATED_STEP) {
+        double x = sum(start + i, 1, count - i < LAB_COMPENSATED_STEP ? count - i : LAB_COMPENSATED_STEP);
+        double t = res + x;
+        c += fabs(res) >= fabs(x) ? (res - t) + x : (x - t) + res;
+        res = t;
+    }
+    return res + c;
+}
+
+/*
+ * Adds a[0..n) as a balanced tree, whose shape depends only on n
+ */
+static inline double pairwiseSum(const double *a, long n) {
+    if (n <= 0) return 0;
+    if (n == 1) return a[0];
+    return pairwiseSum(a, n / 2) + pairwiseSum(a + n / 2, n - n / 2);
+}
+
+/*
+ * Scalar sums for accumulators wider than double
+ */
+static inline labWide seriesSumWide(int kernel, int acc, long start, long step, long count) {
+    if (acc == LAB_ACC_LONG_DOUBLE) {
+        long double res = 0;
+        for (long i = 0, k = start; i < count; ++i, k += step) {
+            if (kernel == LAB_KERNEL_PAIRED) res += 2.0L / ((4.0L * k + 1) * (4.0L * k + 3));
+            else res += (k % 2 == 0 ? 1.0L : -1.0L) / (2.0L * k + 1);
+        }
+        return res;
+    }
+
+    labWide res = 0;
+    for (long i = 0, k = start; i < count; ++i, k += step) {
+        if (kernel == LAB_KERNEL_PAIRED) res += (labWide)2 / (((labWide)4 * k + 1) * ((labWide)4 * k + 3));
+        else res += (labWide)(k % 2 == 0 ? 1 : -1) / ((labWide)2 * k + 1);
+    }
+    return res;
+}
+
+static const char *accNames[] __attribute__((unused)) = {"double", "long double", LAB_WIDE_NAME};
+// unit roundoff of every accumulator
+static const double accRoundoff[] = {DBL_EPSILON / 2, LDBL_EPSILON / 2, (double)LAB_WIDE_EPSILON};
+
+// Euler numbers E_0, E_2, E_4...
+static const double eulerNumbers[LAB_MAX_CORRECTION + 1] = {1, -1, 5, -61, 1385, -50521, 2702765};
+
+/*
+ * pi - 4 * S_N = (-1)^N * sum over m < K of E_2m / (4^m * N^(2m+1)) + O(E_2K / (4^K * N^(2K+1))),
+ * where S_N is the sum of first N terms of the Leibniz series.
+ * Returns the first K terms of this expansion.
+ */
+static inline labWide leibnizTail(long N, int K) {
+    labWide res = 0;
+    labWide power = (labWide)1 / N;
+    labWide step = (labWide)1 / ((labWide)4 * N * N);
+    for (int m = 0; m < K; ++m) {
+        res += eulerNumbers[m] * power;
+        power *= step;
+    }
+    return N % 2 == 0 ? res : -res;
+}
+
+/*
+ * Estimate of |pi - (4 * S_N + leibnizTail(N, K))|. For K = 0 it is the
+ * alternating series bound 4 / (2N+1). For K > 0 the expansion is only
+ * asymptotic, so twice the first omitted term is a heuristic, not a proven bound;
+ * it holds with a wide margin once N is well above K.
+ */
+static inline double leibnizTailBound(double N, int K) {
+    if (K == 0) return 4.0 / (2 * N + 1);
+    return 2 * fabs(eulerNumbers[K]) / (pow(4, K) * pow(N, 2 * K + 1));
+}
+
+/*
+ * Rounding error bound of summing N terms in n naive accumulators
+ * and adding the n partial sums
+ */
+static inline double leibnizRoundingBound(double N, long n, int acc) {
+    return 8 * (N + n) * accRoundoff[acc] * (1 + 0.5 * log(2 * N + 1));
+}
+
+/*
+ * Prints v rounded to digits significant digits, v must be in [1, 10)
+ */
+static inline void printWide(FILE *out, labWide v, int digits) {
+    labWide half = 0.5;
+    for (int i = 1; i < digits; ++i) half /= 10;
+    v += half;
+    int d = (int)v;
+    fprintf(out, digits > 1 ? "%d." : "%d", d);
+    v -= d;
+    for (int i = 1; i < digits; ++i) {
+        v *= 10;
+        d = (int)v;
+        if (d > 9) d = 9;
+        fputc('0' + d, out);
+        v -= d;
+    }
+    fputc('\n', out);
+}
+
+static inline int isSimdSupported(int simd) {
+#ifdef LAB_X86
+    __builtin_cpu_init();
+    switch (simd) {
+    case LAB_SIMD_SSE2: return __builtin_cpu_supports("sse2");
+    case LAB_SIMD_AVX2: return __builtin_cpu_supports("avx2");
+    case LAB_SIMD_AVX512: return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return simd == LAB_SIMD_SCALAR;
+}
+
+static inline int detectSimd() {
+    if (isSimdSupported(LAB_SIMD_AVX512)) return LAB_SIMD_AVX512;
+    if (isSimdSupported(LAB_SIMD_AVX2)) return LAB_SIMD_AVX2;
+    if (isSimdSupported(LAB_SIMD_SSE2)) return LAB_SIMD_SSE2;
+    return LAB_SIMD_SCALAR;
+}
+
+/*
+ * Returns pi as "3.14..." with digits significant digits computed on threads threads,
+ * or NULL if threads can't be started
+ */
+typedef char *(*bigPiFunc)(long threads, long digits);
+
+/*
+ * Kernels either sum a series in doubles, split by indexes between workers,
+ * or compute digits of pi with bignums on their own
+ */
+typedef struct _seriesKernel {
+    const char *name;
+    int termsPerIndex; // series terms covered by one index, 0 for bignum kernels
+    leibnizSumFunc sums[LAB_SIMD_AVX512 + 1]; // by LAB_SIMD_*
+    bigPiFunc bigPi;
+} seriesKernel;
+
+#ifdef LAB_X86
+#define LAB_SUMS(prefix) {prefix##Scalar, prefix##SSE2, prefix##AVX2, prefix##AVX512}
+#else
+#define LAB_SUMS(prefix) {prefix##Scalar, prefix##Scalar, prefix##Scalar, prefix##Scalar}
+#endif
+
+static const seriesKernel kernels[] = {
+    {"leibniz", 1, LAB_SUMS(leibnizSum), NULL},
+    {"paired", 2, LAB_SUMS(pairedSum), NULL},
+    {"machin", 0, {NULL, NULL, NULL, NULL}, machinPi},
+    {"chudnovsky", 0, {NULL, NULL, NULL, NULL}, chudnovskyPi},
+};
+
+static inline leibnizSumFunc leibnizSumFor(int kernel, int simd) {
+    return kernels[kernel].sums[simd];
+}
+
+static inline int isBigKernel(int kernel) {
+    return kernels[kernel].bigPi != NULL;
+}
+
+static const char *simdNames[] = {"scalar", "sse2", "avx2", "avx512"};
+
+/*
+ * Returns LAB_KERNEL_* for name or -1 if name is unknown
+ */
+static inline int parseKernel(const char *name) {
+    for (int i = 0; i < (int)(sizeof(kernels) / sizeof(kernels[0])); ++i)
+        if (strcmp(name, kernels[i].name) == 0) return i;
+    return -1;
+}
+
+/*
+ * Returns LAB_SIMD_* for name or LAB_SIMD_AUTO - 1 if name is unknown
+ */
+static inline int parseSimd(const char *name) {
+    if (strcmp(name, "auto") == 0) return LAB_SIMD_AUTO;
+    for (int i = 0; i < (int)(sizeof(simdNames) / sizeof(simdNames[0])); ++i)
+        if (strcmp(name, simdNames[i]) == 0) return i;
+    return LAB_SIMD_AUTO - 1;
+}
+
+static inline double labNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef LAB_POOL_H
+#define LAB_POOL_H
+
+/*
+ * Persistent pool of pi workers for callers that sum the series many times.
+ * Workers stay parked on a condition variable between jobs, a job is split
+ * into slices that any worker may take, so jobs submitted back to back
+ * are worked on together without waking anyone twice.
+ *
+ *   piPool pool;
+ *   piPoolInit(&pool, threads, LAB_SIMD_AUTO);
+ *   piJob job = {.kernel = LAB_KERNEL_LEIBNIZ, .terms = terms};
+ *   piPoolSubmit(&pool, &job);
+ *   double pi = piPoolWait(&pool, &job);
+ *   piPoolShutdown(&pool);
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "labpi.h"
+
+#define LAB_POOL_MIN_SLICE 65536 // indexes, smaller jobs are split into fewer slices
+
+typedef struct _piJob piJob;
+struct _piJob {
+    // set by the caller
+    int kernel;
+    long terms;
+    long first;     // index the job starts from, 0 for the whole series
+    // set by the pool
+    double result;  // pi
+    double seconds; // from submit to the last slice
+    leibnizSumFunc sum;
+    long indexes;
+    long slices;
+    long taken;     // slices handed out
+    long left;      // slices not finished
+    double *sums;   // of every slice, added in slice order so the result doesn't depend on workers
+    double submitted;
+    int done;
+    piJob *next;
+};
+
+typedef struct _piPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // workers wait here for jobs
+    pthread_cond_t done; // piPoolWait() callers wait here
+    piJob *head;
+    piJob *tail;
+    pthread_t *threads;
+    long n;
+    int simd;
+    int stopping;
+} piPool;
+
+static inline void piJobFinish(piPool *pool, piJob *job) {
+    double sum = 0;
+    for (long i = 0; i < job->slices; ++i) sum += job->sums[i];
+    free(job->sums);
+    job->sums = NULL;
+    job->result = 4 * sum;
+    job->seconds = labNow() - job->submitted;
+    job->done = 1;
+    pthread_cond_broadcast(&pool->done);
+}
+
+static inline void *piPoolWorker(void *param) {
+    piPool *pool = (piPool *)param;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->head == NULL && !pool->stopping)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->head == NULL)
+            break;
+
+        piJob *job = pool->head;
+        long slice = job->taken++;
+        if (job->taken == job->slices) {
+            pool->head = job->next;
+            if (pool->head == NULL) pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        long from = job->first + job->indexes * slice / job->slices;
+        long to = job->first + job->indexes * (slice + 1) / job->slices;
+        double sum = job->sum(from, 1, to - from);
+
+        pthread_mutex_lock(&pool->lock);
+        job->sums[slice] = sum;
+        if (--job->left == 0) piJobFinish(pool, job);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return param;
+}
+
+static inline void piPoolShutdown(piPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (long i = 0; i < pool->n; ++i) pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->n = 0;
+}
+
+/*
+ * Starts threads workers, returns 0 or errno
+ */
+static inline int piPoolInit(piPool *pool, long threads, int simd) {
+    memset(pool, 0, sizeof(*pool));
+    pool->simd = simd == LAB_SIMD_AUTO ? detectSimd() : simd;
+    if (threads <= 0 || !isSimdSupported(pool->simd)) return EINVAL;
+    pool->threads = malloc(sizeof(pthread_t) * threads);
+    if (pool->threads == NULL) return ENOMEM;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (long i = 0; i < threads; ++i) {
+        int code = pthread_create(&pool->threads[i], NULL, piPoolWorker, pool);
+        if (code != 0) {
+            piPoolShutdown(pool);
+            return code;
+        }
+        pool->n++;
+    }
+    return 0;
+}
+
+/*
+ * Queues the job, the caller keeps it alive until piPoolWait() returns.
+ * Returns 0 or errno, EINVAL for bignum kernels.
+ */
+static inline int piPoolSubmit(piPool *pool, piJob *job) {
+    if (job->kernel < 0 || job->kernel >= (int)(sizeof(kernels) / sizeof(kernels[0])) || isBigKernel(job->kernel) || job->terms <= 0)
+        return EINVAL;
+
+    int step = kernels[job->kernel].termsPerIndex;
+    job->sum = leibnizSumFor(job->kernel, pool->simd);
+    job->indexes = (job->terms + step - 1) / step;
+    job->slices = (job->indexes + LAB_POOL_MIN_SLICE - 1) / LAB_POOL_MIN_SLICE;
+    if (job->slices > pool->n) job->slices = pool->n;
+    job->sums = malloc(sizeof(double) * job->slices);
+    if (job->sums == NULL) return ENOMEM;
+    job->taken = 0;
+    job->left = job->slices;
+    job->done = 0;
+    job->next = NULL;
+    job->submitted = labNow();
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) pool->tail->next = job;
+    else pool->head = job;
+    pool->tail = job;
+    if (job->slices == 1) pthread_cond_signal(&pool->work);
+    else pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/*
+ * Returns pi of a submitted job once all of its slices are summed,
+ * 4 times the partial sum if the job doesn't start at 0
+ */
+static inline double piPoolWait(piPool *pool, piJob *job) {
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    return job->result;
+}
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef LAB_RING_H
+#define LAB_RING_H
+
+/*
+ * Bounded lock-free multi-producer ring of preformatted records with one
+ * writer thread that drains it to a file descriptor. The writer copies up to
+ * LAB_RING_BATCH ready records out, frees their slots and writes them with one write().
+ * Producers claim a slot with a CAS on the tail and publish it through the
+ * slot's sequence number, so a slow terminal or pipe only ever blocks the
+ * writer; producers see it once the ring is full, and then follow the policy:
+ *
+ *   LAB_RING_BLOCK  park on a condition variable until the writer frees slots
+ *   LAB_RING_SPIN   yield LAB_RING_SPINS times, then park
+ *   LAB_RING_DROP   count the record as dropped and go on
+ *
+ * Every record is written whole by the single writer, so lines never interleave.
+ * A sleeping writer is only woken once a batch worth writing has piled up,
+ * so a lone record may wait up to LAB_RING_IDLE_NS.
+ *
+ *   logRing ring;
+ *   logRingInit(&ring, STDOUT_FILENO, 4096, LAB_RING_BLOCK);
+ *   logRingPrintf(&ring, "%d %s\n", i, str);  // from any thread
+ *   logRingClose(&ring);                      // after the producers are done
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LAB_RING_BLOCK 0
+#define LAB_RING_SPIN 1
+#define LAB_RING_DROP 2
+
+#define LAB_RING_SLOT 128 // bytes of a slot, longer records are cut
+#define LAB_RING_SPINS 256
+#define LAB_RING_BATCH 1024 // records in one write
+#define LAB_RING_IDLE_NS 1000000 // a sleeping writer looks at the ring at least this often
+#define LAB_RING_WAKE_SHIFT 4 // producers wake the writer once 1/16 of the ring is ready
+
+typedef struct _ringSlot {
+    unsigned long seq; // position + 1 when the record is ready, position + slots when the slot is free
+    unsigned int len;
+    char data[LAB_RING_SLOT - sizeof(unsigned long) - sizeof(unsigned int)];
+} ringSlot;
+
+static const char *ringPolicyNames[] = {"block", "spin", "drop"};
+
+typedef struct _logRing {
+    ringSlot *slots;
+    char *batch;          // the writer's copy of LAB_RING_BATCH records
+    unsigned long mask;
+    int fd;
+    int policy;
+    unsigned long wakeAt;  // ready records that make a producer wake the writer
+    unsigned long tail __attribute__((aligned(64))); // next slot to claim, shared by producers
+    unsigned long head __attribute__((aligned(64))); // next slot to write, owned by the writer
+    int closing;
+    int writerSleeping;
+    int parked;           // producers waiting for room
+    int error;            // errno of the first failed write
+    pthread_mutex_t lock;
+    pthread_cond_t work;  // the writer waits here for records
+    pthread_cond_t room;  // parked producers wait here
+    pthread_t writer;
+    // stats
+    unsigned long records;    // written by the writer
+    unsigned long dropped;
+    unsigned long stalls;     // pushes that found the ring full
+    unsigned long stallNs;    // time producers spent waiting for room
+    unsigned long batches;
+    unsigned long occupancySum; // ready records summed over batches
+    unsigned long maxOccupancy;
+} logRing;
+
+static inline unsigned long ringNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline void ringWakeWriter(logRing *r, unsigned long ready) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->writerSleeping, __ATOMIC_RELAXED)
+        && ready - __atomic_load_n(&r->head, __ATOMIC_RELAXED) >= r->wakeAt) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->work);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+/*
+ * Writes size bytes whole, retrying partial writes
+ */
+static inline int ringWriteAll(int fd, const char *data, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t w = write(fd, data + done, size - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return errno;
+        done += w;
+    }
+    return 0;
+}
+
+static inline void *ringWriter(void *param) {
+    logRing *r = (logRing *)param;
+    while (1) {
+        unsigned long head = r->head;
+        unsigned long occupancy = __atomic_load_n(&r->tail, __ATOMIC_RELAXED) - head;
+        int count = 0;
+        size_t size = 0;
+        while (count < LAB_RING_BATCH) {
+            ringSlot *s = &r->slots[(head + count) & r->mask];
+            if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != head + count + 1) break;
+            memcpy(r->batch + size, s->data, s->len);
+            size += s->len;
+            __atomic_store_n(&s->seq, head + count + r->mask + 1, __ATOMIC_RELEASE);
+            count++;
+        }
+
+        if (count == 0) {
+            pthread_mutex_lock(&r->lock);
+            __atomic_store_n(&r->writerSleeping, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            ringSlot *s = &r->slots[head & r->mask];
+            int ready = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == head + 1;
+            if (!ready && __atomic_load_n(&r->closing, __ATOMIC_ACQUIRE)) {
+                pthread_mutex_unlock(&r->lock);
+                break;
+            }
+            if (!ready) {
+                struct timespec until;
+                clock_gettime(CLOCK_MONOTONIC, &until);
+                until.tv_nsec += LAB_RING_IDLE_NS;
+                until.tv_sec += until.tv_nsec / 1000000000;
+                until.tv_nsec %= 1000000000;
+                pthread_cond_timedwait(&r->work, &r->lock, &until);
+            }
+            __atomic_store_n(&r->writerSleeping, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&r->lock);
+            continue;
+        }
+
+        __atomic_store_n(&r->head, head + count, __ATOMIC_RELAXED);
+        r->batches++;
+        r->records += count;
+        r->occupancySum += occupancy;
+        if (occupancy > r->maxOccupancy) r->maxOccupancy = occupancy;
+
+        // producers may refill the slots while the batch is being written
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->parked, __ATOMIC_RELAXED) > 0) {
+            pthread_mutex_lock(&r->lock);
+            pthread_cond_broadcast(&r->room);
+            pthread_mutex_unlock(&r->lock);
+        }
+        if (r->error == 0) r->error = ringWriteAll(r->fd, r->batch, size);
+    }
+    return param;
+}
+
+/*
+ * Waits until the slot at pos is free again, following the policy.
+ * Returns 0 or EAGAIN if the record is dropped.
+ */
+static inline int ringWaitForRoom(logRing *r, ringSlot *s, unsigned long pos) {
+    if (r->policy == LAB_RING_DROP) {
+        __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+        return EAGAIN;
+    }
+    unsigned long begin = ringNowNs();
+    __atomic_add_fetch(&r->stalls, 1, __ATOMIC_RELAXED);
+    ringWakeWriter(r, pos);
+
+    int spins = r->policy == LAB_RING_SPIN ? LAB_RING_SPINS : 0;
+    for (int i = 0; i < spins && (long)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos) < 0; ++i)
+        sched_yield();
+
+    pthread_mutex_lock(&r->lock);
+    __atomic_add_fetch(&r->parked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while ((long)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos) < 0)
+        pthread_cond_wait(&r->room, &r->lock);
+    __atomic_sub_fetch(&r->parked, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&r->lock);
+
+    __atomic_add_fetch(&r->stallNs, ringNowNs() - begin, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * Claims the next slot, returns it or NULL if the record is dropped
+ */
+static inline ringSlot *ringClaim(logRing *r, unsigned long *claimed) {
+    unsigned long pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    while (1) {
+        ringSlot *s = &r->slots[pos & r->mask];
+        long diff = (long)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *claimed = pos;
+                return s;
+            }
+        } else if (diff < 0) {
+            if (ringWaitForRoom(r, s, pos) != 0) return NULL;
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static inline void ringPublish(logRing *r, ringSlot *s, unsigned long pos) {
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+    ringWakeWriter(r, pos + 1);
+}
+
+/*
+ * Formats a record straight into its slot. Returns 0 or EAGAIN if it was dropped.
+ */
+static inline int logRingPrintf(logRing *r, const char *format, ...) {
+    unsigned long pos;
+    ringSlot *s = ringClaim(r, &pos);
+    if (s == NULL) return EAGAIN;
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(s->data, sizeof(s->data), format, args);
+    va_end(args);
+    if (len < 0) len = 0;
+    if ((size_t)len >= sizeof(s->data)) len = sizeof(s->data) - 1;
+    s->len = len;
+    ringPublish(r, s, pos);
+    return 0;
+}
+
+static inline int logRingPush(logRing *r, const char *data, size_t len) {
+    unsigned long pos;
+    ringSlot *s = ringClaim(r, &pos);
+    if (s == NULL) return EAGAIN;
+    if (len > sizeof(s->data)) len = sizeof(s->data);
+    memcpy(s->data, data, len);
+    s->len = len;
+    ringPublish(r, s, pos);
+    return 0;
+}
+
+/*
+ * slots is rounded up to a power of two. Returns 0 or errno.
+ */
+static inline int logRingInit(logRing *r, int fd, size_t slots, int policy) {
+    memset(r, 0, sizeof(*r));
+    size_t size = 2;
+    while (size < slots) size *= 2;
+    r->slots = aligned_alloc(LAB_RING_SLOT, size * sizeof(ringSlot));
+    r->batch = malloc(LAB_RING_BATCH * sizeof(r->slots->data));
+    if (r->slots == NULL || r->batch == NULL) {
+        free(r->slots);
+        free(r->batch);
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < size; ++i) r->slots[i].seq = i;
+    r->mask = size - 1;
+    r->wakeAt = size >> LAB_RING_WAKE_SHIFT > 0 ? size >> LAB_RING_WAKE_SHIFT : 1;
+    r->fd = fd;
+    r->policy = policy;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->work, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&r->room, NULL);
+
+    int code = pthread_create(&r->writer, NULL, ringWriter, r);
+    if (code != 0) {
+        pthread_cond_destroy(&r->work);
+        pthread_cond_destroy(&r->room);
+        pthread_mutex_destroy(&r->lock);
+        free(r->slots);
+        free(r->batch);
+        r->slots = NULL;
+    }
+    return code;
+}
+
+/*
+ * Writes what is left and stops the writer; no producer may push any more.
+ * Returns 0 or errno of the first failed write.
+ */
+static inline int logRingClose(logRing *r) {
+    __atomic_store_n(&r->closing, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_signal(&r->work);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->writer, NULL);
+    pthread_cond_destroy(&r->work);
+    pthread_cond_destroy(&r->room);
+    pthread_mutex_destroy(&r->lock);
+    free(r->slots);
+    free(r->batch);
+    r->slots = NULL;
+    return r->error;
+}
+
+static inline void printLogRingStats(logRing *r, FILE *out) {
+    fprintf(out, "ring slots=%lu policy=%s records=%lu dropped=%lu batches=%lu occupancy avg=%.1f max=%lu stalls=%lu stall time=%.3fms\n",
+        r->mask + 1, ringPolicyNames[r->policy], r->records, r->dropped, r->batches,
+        r->batches > 0 ? (double)r->occupancySum / r->batches : 0.0, r->maxOccupancy, r->stalls, r->stallNs / 1e6);
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef LAB_SEQ_H
+#define LAB_SEQ_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "labpi.h"
+
+/*
+ * Single writer seqlock slot: the owning worker publishes its progress
+ * and any other thread takes a consistent snapshot without stopping it
+ */
+typedef struct _seqSlot {
+    unsigned long seq;
+    double terms;
+    double sum;
+} seqSlot;
+
+static inline void seqPublish(seqSlot *s, double terms, double sum) {
+    unsigned long seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&s->terms, &terms, __ATOMIC_RELAXED);
+    __atomic_store(&s->sum, &sum, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static inline void seqRead(seqSlot *s, double *terms, double *sum) {
+    unsigned long before, after;
+    do {
+        before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        __atomic_load(&s->terms, terms, __ATOMIC_RELAXED);
+        __atomic_load(&s->sum, sum, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+/*
+ * Live snapshots of the slots of a running series sum. The estimate adds baseSum,
+ * the part summed before the run, rates are taken since the previous snapshot.
+ */
+typedef struct _progressReport {
+    pthread_mutex_t lock;
+    seqSlot **slots;
+    long n;
+    double baseTerms;
+    double baseSum;
+    double begin;
+    double last;
+    double *lastTerms;
+    double *terms; // of the snapshot being printed
+} progressReport;
+
+static inline int initProgress(progressReport *r, long n, double baseTerms, double baseSum) {
+    r->slots = calloc(n, sizeof(seqSlot *));
+    r->lastTerms = calloc(n, sizeof(double));
+    r->terms = calloc(n, sizeof(double));
+    if (r->slots == NULL || r->lastTerms == NULL || r->terms == NULL) {
+        free(r->slots);
+        free(r->lastTerms);
+        free(r->terms);
+        return 0;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    r->n = n;
+    r->baseTerms = baseTerms;
+    r->baseSum = baseSum;
+    r->begin = r->last = labNow();
+    return 1;
+}
+
+static inline void freeProgress(progressReport *r) {
+    pthread_mutex_destroy(&r->lock);
+    free(r->slots);
+    free(r->lastTerms);
+    free(r->terms);
+}
+
+/*
+ * Prints the pi estimate, its distance from M_PI and the truncation error
+ * 1/N of the Leibniz series after as many terms as were summed
+ */
+static inline void printProgress(progressReport *r, FILE *out) {
+    pthread_mutex_lock(&r->lock);
+    double now = labNow();
+    double span = now - r->last > 0 ? now - r->last : 1e-9;
+    double terms = r->baseTerms, sum = r->baseSum, recent = 0;
+    for (long i = 0; i < r->n; ++i) {
+        double s;
+        seqRead(r->slots[i], &r->terms[i], &s);
+        terms += r->terms[i];
+        sum += s;
+        recent += r->terms[i] - r->lastTerms[i];
+    }
+    double pi = 4 * sum;
+    fprintf(out, "progress t=%.3fs terms=%.0f terms/sec=%.6g pi=%.15f error=%.3g est error=%.3g\n",
+        now - r->begin, terms, recent / span, pi, fabs(pi - M_PI), terms > 0 ? 1 / terms : INFINITY);
+    fprintf(out, "progress per thread terms/sec=");
+    for (long i = 0; i < r->n; ++i) {
+        fprintf(out, i == 0 ? "%.4g" : " %.4g", (r->terms[i] - r->lastTerms[i]) / span);
+        r->lastTerms[i] = r->terms[i];
+    }
+    fprintf(out, "\n");
+    fflush(out);
+    r->last = now;
+    pthread_mutex_unlock(&r->lock);
+}
+
+#endif
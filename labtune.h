@@ -0,0 +1,224 @@
+#ifndef LAB_TUNE_H
+#define LAB_TUNE_H
+
+/*
+ * Calibration of thread count, chunk size, kernel and simd level for this host.
+ * Trials sum a fixed number of indexes with threads claiming chunks from a
+ * shared counter, so small chunks pay for contention and big ones for the
+ * uneven finish. The winner is kept in a per-host text file:
+ *
+ *   labtune1
+ *   host=name
+ *   cpus=8
+ *   threads=8
+ *   chunk=65536
+ *   kernel=paired
+ *   simd=avx2
+ *   rate=5.1e+09
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "labpi.h"
+#include "labcpu.h"
+
+#define LAB_TUNE_MAGIC "labtune1"
+#define LAB_TUNE_TRIAL 0.1        // seconds of work in one trial
+#define LAB_TUNE_REPEAT 2         // trials per configuration, the fastest counts
+#define LAB_TUNE_CHUNK 65536      // indexes claimed at a time until chunks are tuned
+#define LAB_TUNE_MIN_CHUNK 1024
+#define LAB_TUNE_MAX_CHUNK (1L << 20)
+
+typedef struct _tuneConfig {
+    long threads;
+    long chunk;   // indexes
+    int kernel;
+    int simd;
+    double rate;  // terms/sec of the winning trial
+} tuneConfig;
+
+typedef struct _tuneTrial {
+    leibnizSumFunc sum;
+    long chunk;
+    long total;
+    long next;    // first unclaimed index
+    double sink;  // keeps the sums alive
+} tuneTrial;
+
+static inline void *tuneWorker(void *param) {
+    tuneTrial *t = (tuneTrial *)param;
+    double res = 0;
+    while (1) {
+        long from = __atomic_fetch_add(&t->next, t->chunk, __ATOMIC_RELAXED);
+        if (from >= t->total) break;
+        long count = from + t->chunk < t->total ? t->chunk : t->total - from;
+        res += t->sum(from, 1, count);
+    }
+    __atomic_store(&t->sink, &res, __ATOMIC_RELAXED);
+    return param;
+}
+
+/*
+ * Terms/sec of summing total indexes with threads threads, 0 if threads can't be created
+ */
+static inline double tuneRun(int kernel, int simd, long threads, long chunk, long total) {
+    tuneTrial trial = {leibnizSumFor(kernel, simd), chunk, total, 0, 0};
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+    if (ids == NULL) return 0;
+
+    double best = 0;
+    for (int r = 0; r < LAB_TUNE_REPEAT; ++r) {
+        trial.next = 0;
+        double begin = labNow();
+        long started = 0;
+        while (started < threads && pthread_create(&ids[started], NULL, tuneWorker, &trial) == 0) started++;
+        for (long i = 0; i < started; ++i) pthread_join(ids[i], NULL);
+        double wall = labNow() - begin;
+        if (started < threads) {
+            best = 0;
+            break;
+        }
+        double rate = wall > 0 ? (double)total * kernels[kernel].termsPerIndex / wall : 0;
+        if (rate > best) best = rate;
+    }
+    free(ids);
+    return best;
+}
+
+/*
+ * Tunes one setting at a time: kernel and simd level on one thread,
+ * then the thread count, then the chunk size. Trials are printed to log if it isn't NULL.
+ */
+static inline void calibrate(tuneConfig *best, FILE *log) {
+    long cpus = availableCpus();
+    *best = (tuneConfig){1, LAB_TUNE_CHUNK, LAB_KERNEL_LEIBNIZ, detectSimd(), 0};
+
+    // sized so one thread of the slowest candidate takes about LAB_TUNE_TRIAL
+    double probe = tuneRun(LAB_KERNEL_LEIBNIZ, LAB_SIMD_SCALAR, 1, LAB_TUNE_CHUNK, 1L << 20);
+    long total = (long)(probe * LAB_TUNE_TRIAL);
+    if (total < LAB_TUNE_MAX_CHUNK) total = LAB_TUNE_MAX_CHUNK;
+
+    for (int k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); ++k) {
+        if (isBigKernel(k)) continue;
+        for (int s = LAB_SIMD_SCALAR; s < (int)(sizeof(simdNames) / sizeof(simdNames[0])); ++s) {
+            if (!isSimdSupported(s)) continue;
+            double rate = tuneRun(k, s, 1, LAB_TUNE_CHUNK, total / kernels[k].termsPerIndex);
+            if (log != NULL) fprintf(log, "tune kernel=%s simd=%s threads=1 terms/sec=%.6g\n", kernels[k].name, simdNames[s], rate);
+            if (rate > best->rate) {
+                best->kernel = k;
+                best->simd = s;
+                best->rate = rate;
+            }
+        }
+    }
+
+    // the same work for every thread count, enough for all cpus to take about LAB_TUNE_TRIAL
+    total = (long)(best->rate / kernels[best->kernel].termsPerIndex * cpus * LAB_TUNE_TRIAL);
+    best->rate = 0;
+    for (long t = 1; t <= 2 * cpus; t = t < cpus && 2 * t > cpus ? cpus : 2 * t) {
+        double rate = tuneRun(best->kernel, best->simd, t, LAB_TUNE_CHUNK, total);
+        if (log != NULL) fprintf(log, "tune threads=%ld chunk=%d terms/sec=%.6g\n", t, LAB_TUNE_CHUNK, rate);
+        if (rate > best->rate) {
+            best->threads = t;
+            best->rate = rate;
+        }
+    }
+
+    best->rate = 0;
+    for (long c = LAB_TUNE_MIN_CHUNK; c <= LAB_TUNE_MAX_CHUNK; c *= 4) {
+        double rate = tuneRun(best->kernel, best->simd, best->threads, c, total);
+        if (log != NULL) fprintf(log, "tune threads=%ld chunk=%ld terms/sec=%.6g\n", best->threads, c, rate);
+        if (rate > best->rate) {
+            best->chunk = c;
+            best->rate = rate;
+        }
+    }
+}
+
+/*
+ * Writes path or, if path is NULL, $HOME/.oslabtune.<host> into buf
+ */
+static inline int tunePath(char *buf, size_t size, const char *path) {
+    if (path != NULL) {
+        if (snprintf(buf, size, "%s", path) >= (int)size) return ENAMETOOLONG;
+        return 0;
+    }
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    const char *home = getenv("HOME");
+    if (snprintf(buf, size, "%s/.oslabtune.%s", home != NULL ? home : ".", host) >= (int)size) return ENAMETOOLONG;
+    return 0;
+}
+
+/*
+ * Returns 0, errno of opening the file or ESTALE if it was tuned
+ * on another host, for another cpu count or with an unsupported simd level
+ */
+static inline int loadTune(const char *path, tuneConfig *c) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return errno;
+
+    char line[512], host[256] = "", myHost[256] = "localhost", kernel[32] = "", simd[32] = "";
+    long cpus = 0;
+    int magic = 0;
+    memset(c, 0, sizeof(*c));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, LAB_TUNE_MAGIC, strlen(LAB_TUNE_MAGIC)) == 0) magic = 1;
+        sscanf(line, "host=%255s", host);
+        sscanf(line, "cpus=%ld", &cpus);
+        sscanf(line, "threads=%ld", &c->threads);
+        sscanf(line, "chunk=%ld", &c->chunk);
+        sscanf(line, "kernel=%31s", kernel);
+        sscanf(line, "simd=%31s", simd);
+        sscanf(line, "rate=%lf", &c->rate);
+    }
+    fclose(f);
+
+    gethostname(myHost, sizeof(myHost) - 1);
+    c->kernel = parseKernel(kernel);
+    c->simd = parseSimd(simd);
+    if (!magic || c->threads <= 0 || c->chunk <= 0 || c->kernel < 0 || isBigKernel(c->kernel) || c->simd < LAB_SIMD_SCALAR)
+        return EINVAL;
+    if (strcmp(host, myHost) != 0 || cpus != availableCpus() || !isSimdSupported(c->simd))
+        return ESTALE;
+    return 0;
+}
+
+/*
+ * Replaces path with c through a temporary file
+ */
+static inline int saveTune(const char *path, const tuneConfig *c) {
+    char tmp[PATH_MAX], host[256] = "localhost";
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return ENAMETOOLONG;
+    gethostname(host, sizeof(host) - 1);
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) return errno;
+    fprintf(f, "%s\nhost=%s\ncpus=%ld\nthreads=%ld\nchunk=%ld\nkernel=%s\nsimd=%s\nrate=%.6g\n", LAB_TUNE_MAGIC,
+        host, availableCpus(), c->threads, c->chunk, kernels[c->kernel].name, simdNames[c->simd], c->rate);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        int code = errno;
+        unlink(tmp);
+        return code;
+    }
+    return 0;
+}
+
+/*
+ * Loads the config of this host from path, or calibrates and saves it if the
+ * file is missing, stale or force is set. *calibrated tells which happened.
+ * Returns 0 or errno of saving, c is usable either way.
+ */
+static inline int loadOrCalibrate(const char *path, int force, tuneConfig *c, int *calibrated, FILE *log) {
+    *calibrated = force || loadTune(path, c) != 0;
+    if (!*calibrated) return 0;
+    calibrate(c, log);
+    return saveTune(path, c);
+}
+
+#endif
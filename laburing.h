@@ -0,0 +1,287 @@
+#ifndef LAB_URING_H
+#define LAB_URING_H
+
+/*
+ * Output sink that writes whole buffers to a regular file through io_uring,
+ * with raw syscalls like labperf.h so no liburing is needed. A thread takes a
+ * free buffer, fills it and submits it; the write goes on in the kernel while
+ * the thread fills the next one, it only waits when every buffer is in flight.
+ * Every submitted buffer gets its own file offset, claimed in submit order, so
+ * the file holds whole buffers back to back exactly as with write() under one lock.
+ *
+ *   uringSink u;
+ *   if (uringOpen(&u, STDOUT_FILENO, 64, 16384) != 0) ... // fall back to write()
+ *   int b;
+ *   char *data = uringGetBuffer(&u, &b);
+ *   ... fill len bytes ...
+ *   uringSubmit(&u, b, len);
+ *   uringClose(&u);
+ *
+ * Buffers are registered with the kernel when it allows it (RLIMIT_MEMLOCK on
+ * older kernels), otherwise plain IORING_OP_WRITE is used. Writes the kernel
+ * fails or cuts short are finished with pwrite(), among them the ones it
+ * cancels because the thread that submitted them has exited.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+typedef struct _uringSink {
+    int ring;
+    int fd;
+    off_t offset;       // where the next submitted buffer goes
+    // shared with the kernel
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqMap, *cqMap;
+    size_t sqMapSize, cqMapSize, sqesSize;
+    // buffers
+    char *buffers;
+    size_t size;        // bytes of one buffer
+    int count;
+    int registered;
+    int *free;          // stack of free buffer indexes
+    int freeCount;
+    int inFlight;
+    size_t *lengths;    // of the submitted buffers, to finish short writes
+    off_t *offsets;
+    pthread_mutex_t lock;
+    pthread_cond_t submitted; // threads waiting while all buffers are being filled
+    int error;          // errno of the first failed write
+    // stats
+    unsigned long writes;
+    unsigned long shortWrites; // and failed ones finished with pwrite()
+    unsigned long waits; // takes that found no free buffer
+} uringSink;
+
+static inline int uringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uringEnter(int ring, unsigned submit, unsigned complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring, submit, complete, flags, NULL, 0);
+}
+
+/*
+ * Finishes a write the kernel failed or cut short. Called with the lock held.
+ */
+static inline void uringFinish(uringSink *u, int b, int res) {
+    size_t done = res > 0 ? (size_t)res : 0;
+    if (res < 0 && res != -EINTR && res != -EAGAIN && res != -EINVAL && res != -EOPNOTSUPP
+        && res != -ECANCELED) {
+        if (u->error == 0) u->error = -res;
+        return;
+    }
+    u->shortWrites++;
+    while (done < u->lengths[b]) {
+        ssize_t w = pwrite(u->fd, u->buffers + b * u->size + done, u->lengths[b] - done, u->offsets[b] + done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            if (u->error == 0) u->error = w < 0 ? errno : EIO;
+            return;
+        }
+        done += w;
+    }
+}
+
+/*
+ * Takes finished writes off the completion queue, their buffers become free.
+ * With wait set blocks until at least one finishes. Called with the lock held.
+ */
+static inline void uringReap(uringSink *u, int wait) {
+    if (wait && uringEnter(u->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && u->error == 0)
+        u->error = errno;
+    unsigned head = *u->cqHead;
+    unsigned tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+        int b = (int)cqe->user_data;
+        if (cqe->res < 0 || (size_t)cqe->res < u->lengths[b]) uringFinish(u, b, cqe->res);
+        u->free[u->freeCount++] = b;
+        u->inFlight--;
+    }
+    __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns a free buffer of u->size bytes and its index in *b
+ */
+static inline char *uringGetBuffer(uringSink *u, int *b) {
+    pthread_mutex_lock(&u->lock);
+    uringReap(u, 0);
+    if (u->freeCount == 0) u->waits++;
+    while (u->freeCount == 0) {
+        if (u->inFlight > 0) uringReap(u, 1);
+        else pthread_cond_wait(&u->submitted, &u->lock);
+    }
+    *b = u->free[--u->freeCount];
+    pthread_mutex_unlock(&u->lock);
+    return u->buffers + *b * u->size;
+}
+
+/*
+ * Queues the first len bytes of buffer b for writing, len 0 just gives it back.
+ * Returns 0 or errno of the first failed write so far.
+ */
+static inline int uringSubmit(uringSink *u, int b, size_t len) {
+    pthread_mutex_lock(&u->lock);
+    if (len == 0) {
+        u->free[u->freeCount++] = b;
+    } else {
+        unsigned tail = *u->sqTail;
+        unsigned index = tail & *u->sqMask;
+        struct io_uring_sqe *sqe = &u->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = u->registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = u->fd;
+        sqe->addr = (unsigned long)(u->buffers + b * u->size);
+        sqe->len = len;
+        sqe->off = u->offset;
+        sqe->buf_index = u->registered ? b : 0;
+        sqe->user_data = b;
+        u->sqArray[index] = index;
+        __atomic_store_n(u->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        u->lengths[b] = len;
+        u->offsets[b] = u->offset;
+        u->offset += len;
+        u->inFlight++;
+        u->writes++;
+        int code;
+        while ((code = uringEnter(u->ring, 1, 0, 0)) < 0 && errno == EINTR);
+        if (code < 0) {
+            // never reached the kernel, take it back and write it here
+            __atomic_store_n(u->sqTail, tail, __ATOMIC_RELEASE);
+            u->inFlight--;
+            uringFinish(u, b, -EINVAL);
+            u->free[u->freeCount++] = b;
+        }
+    }
+    pthread_cond_broadcast(&u->submitted);
+    int code = u->error;
+    pthread_mutex_unlock(&u->lock);
+    return code;
+}
+
+static inline void uringUnmap(uringSink *u) {
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqesSize);
+    if (u->cqMap != NULL && u->cqMap != MAP_FAILED && u->cqMap != u->sqMap) munmap(u->cqMap, u->cqMapSize);
+    if (u->sqMap != NULL && u->sqMap != MAP_FAILED) munmap(u->sqMap, u->sqMapSize);
+    if (u->ring >= 0) close(u->ring);
+    free(u->buffers);
+    free(u->free);
+    free(u->lengths);
+    free(u->offsets);
+    u->ring = -1;
+}
+
+/*
+ * count buffers of size bytes writing to fd from its current offset.
+ * Returns 0, ENOSYS or EPERM when io_uring is unavailable, ESPIPE if fd isn't
+ * a regular file or is in append mode (offsets can't be kept), ENOMEM.
+ */
+static inline int uringOpen(uringSink *u, int fd, int count, size_t size) {
+    memset(u, 0, sizeof(*u));
+    u->ring = -1;
+    u->fd = fd;
+    u->count = count;
+    u->size = size;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) return errno;
+    int flags = fcntl(fd, F_GETFL);
+    if (!S_ISREG(st.st_mode) || flags < 0 || (flags & O_APPEND)) return ESPIPE;
+    u->offset = lseek(fd, 0, SEEK_CUR);
+    if (u->offset < 0) return errno;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->ring = uringSetup(count, &p);
+    if (u->ring < 0) {
+        u->ring = -1;
+        return errno;
+    }
+
+    u->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cqMapSize > u->sqMapSize) u->sqMapSize = u->cqMapSize;
+        u->cqMapSize = u->sqMapSize;
+    }
+    u->sqMap = mmap(NULL, u->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQ_RING);
+    u->cqMap = p.features & IORING_FEAT_SINGLE_MMAP ? u->sqMap
+        : mmap(NULL, u->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_CQ_RING);
+    u->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQES);
+    if (u->sqMap == MAP_FAILED || u->cqMap == MAP_FAILED || u->sqes == MAP_FAILED) {
+        int code = errno;
+        uringUnmap(u);
+        return code;
+    }
+    char *sq = u->sqMap, *cq = u->cqMap;
+    u->sqHead = (unsigned *)(sq + p.sq_off.head);
+    u->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    u->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sqArray = (unsigned *)(sq + p.sq_off.array);
+    u->cqHead = (unsigned *)(cq + p.cq_off.head);
+    u->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    u->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    u->buffers = aligned_alloc(4096, (count * size + 4095) / 4096 * 4096);
+    u->free = malloc(sizeof(int) * count);
+    u->lengths = malloc(sizeof(size_t) * count);
+    u->offsets = malloc(sizeof(off_t) * count);
+    struct iovec *iov = malloc(sizeof(struct iovec) * count);
+    if (u->buffers == NULL || u->free == NULL || u->lengths == NULL || u->offsets == NULL || iov == NULL) {
+        free(iov);
+        uringUnmap(u);
+        return ENOMEM;
+    }
+    for (int b = 0; b < count; ++b) {
+        iov[b].iov_base = u->buffers + b * size;
+        iov[b].iov_len = size;
+        u->free[b] = count - 1 - b;
+    }
+    u->freeCount = count;
+    u->registered = syscall(__NR_io_uring_register, u->ring, IORING_REGISTER_BUFFERS, iov, count) == 0;
+    free(iov);
+
+    pthread_mutex_init(&u->lock, NULL);
+    pthread_cond_init(&u->submitted, NULL);
+    return 0;
+}
+
+/*
+ * Waits for the writes in flight and leaves the file offset of fd after the
+ * written data. Every buffer must have been submitted. Returns 0 or errno.
+ */
+static inline int uringClose(uringSink *u) {
+    pthread_mutex_lock(&u->lock);
+    while (u->inFlight > 0) uringReap(u, 1);
+    pthread_mutex_unlock(&u->lock);
+    if (lseek(u->fd, u->offset, SEEK_SET) < 0 && u->error == 0) u->error = errno;
+    if (u->registered) syscall(__NR_io_uring_register, u->ring, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    uringUnmap(u);
+    pthread_cond_destroy(&u->submitted);
+    pthread_mutex_destroy(&u->lock);
+    return u->error;
+}
+
+static inline void printUringStats(uringSink *u, FILE *out) {
+    fprintf(out, "uring buffers=%d registered=%s writes=%lu short writes=%lu waits=%lu\n",
+        u->count, u->registered ? "yes" : "no", u->writes, u->shortWrites, u->waits);
+}
+
+#endif
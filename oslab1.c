@@ -3,25 +3,37 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "labring.h"
 
 #define LAB_THREAD_CREATE_SUCCESS 0
 
 #define LAB_SUCCESS 0
 #define LAB_FAIL 1
+#define LAB_BAD_ARGS 5
+
+#define LAB_RING_RECORDS 1024
 
 typedef struct _lparam {
     char *str;
     int count;
 } lparam;
 
+static logRing *ring; // NULL when lines go through printf
+
 void * run(void * param) {
     if (param == NULL)
         return param;
     lparam *p = (lparam*)param;
     char *str = p->str;
     int i;
-    for (i=0; i<p->count; i++) 
-        printf("%d %s\n", i, str);
+    for (i=0; i<p->count; i++) {
+        if (ring != NULL)
+            logRingPrintf(ring, "%d %s\n", i, str);
+        else
+            printf("%d %s\n", i, str);
+    }
 	return param;
 }
 
@@ -29,6 +41,26 @@ void print_error(int code, pthread_t thread, char * what) {
     fprintf(stderr, "Error: %lu %s: %s\n", thread, what, strerror(code));
 }
 
+/*
+ * Returns the backpressure policy of --ring=block|spin|drop, -1 without --ring
+ */
+int parseRingOption(int argc, char *argv[]) {
+    int policy = -1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ring=block") == 0 || strcmp(argv[i], "--ring") == 0) {
+            policy = LAB_RING_BLOCK;
+        } else if (strcmp(argv[i], "--ring=spin") == 0) {
+            policy = LAB_RING_SPIN;
+        } else if (strcmp(argv[i], "--ring=drop") == 0) {
+            policy = LAB_RING_DROP;
+        } else {
+            fprintf(stderr, "Expected arguments: [ --ring[=block|spin|drop] ]\n");
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    return policy;
+}
+
 int main(int argc, char *argv[]) {
     // since @param attr is null, default attributes for child are set up using pthread_attr_init(3C)
     // https://illumos.org/man/3C/pthread_create usr/src/lib/libc/port/threads/pthread.c
@@ -39,6 +71,17 @@ int main(int argc, char *argv[]) {
     pthread_attr_t attr;
     static lparam child = {"I was  born!", 10};
     static lparam parent = {"I gave a birth!", 10};
+    static logRing lines;
+
+    int policy = parseRingOption(argc, argv);
+    if (policy >= 0) {
+        int code = logRingInit(&lines, STDOUT_FILENO, LAB_RING_RECORDS, policy);
+        if (code != 0) {
+            print_error(code, pthread_self(), "can't start the output ring");
+            exit(LAB_FAIL);
+        }
+        ring = &lines;
+    }
 
     // By calling this we allocate memory for thrattr_t *ap, which is stored in attr->__pthread_attrp,  
     // and has value of *def_thrattr().
@@ -56,6 +99,18 @@ int main(int argc, char *argv[]) {
     }
     run(&parent);
 
+    if (ring != NULL) {
+        // the writer thread would keep the process alive after pthread_exit,
+        // so here the child is waited for and the ring closed by hand
+        pthread_join(thread, NULL);
+        code = logRingClose(ring);
+        printLogRingStats(ring, stderr);
+        if (code != 0) {
+            print_error(code, pthread_self(), "can't write output");
+            exit(LAB_FAIL);
+        }
+    }
+
     // By calling this we free attr->__pthread_attrp and set attr->__pthread_attrp to NULL
     pthread_attr_destroy(&attr);
     /*
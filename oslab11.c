@@ -7,6 +7,8 @@
 #include <math.h>
 #include <limits.h>
 
+#include "labperf.h"
+
 #define LAB_NO_ERROR 0
 #define LAB_BAD 1
 
@@ -17,6 +19,8 @@
 #define LAB_FATAL 6
 #define LAB_BAD_ARGS 7
 
+#define LAB_CACHE_LINE 64
+
 #define LAB_THREADS_NUMBER 2
 #define LAB_MUTEX_NUMBER (LAB_THREADS_NUMBER + 1)
 
@@ -48,7 +52,8 @@ struct _threadLabNode {
     pthread_t thread; 
     int status;
     int section;
-};
+    perfCounters perf; // filled when --perf is given
+} __attribute__((aligned(LAB_CACHE_LINE)));
 
 typedef struct _errorIndexPair errorIndexPair;
 struct _errorIndexPair {
@@ -56,6 +61,8 @@ struct _errorIndexPair {
     long i;
 };
 
+static int perfEnabled = 0; // --perf: count cycles, instructions and misses of both threads
+
 void printError(int code, pthread_t thread, char * what) {
     fprintf(stderr, "Error with thr %lu\n%s; %s\n", thread, what, strerror(code));
 }
@@ -84,9 +91,10 @@ int setStatusIfAnyError(int status, int section, threadLabNode* t) {
 }
 
 int isSync = LAB_NO_SYNC; 
-void * run(void * param) {
-    if (param == NULL) return param;
-    threadLabNode *t = (threadLabNode*)param;
+/*
+ * Every exit, early ones on errors included, goes back to run, which stops the counters
+ */
+void runRounds(threadLabNode *t) {
     runParams p = t->params;
 
     pthread_mutex_t *mutexes = p.mutexes;
@@ -99,25 +107,25 @@ void * run(void * param) {
     if (id == 0) usleep(LAB_SLEEP);
     while (!isSync && id != 0)  {
         status = lockAndYield(&mutexes[LAB_STATE_READY]);
-        if (setStatusIfAnyError(status, LAB_PSEUDOSYNC_SECTION, t)) return param;
+        if (setStatusIfAnyError(status, LAB_PSEUDOSYNC_SECTION, t)) return;
     }
     
     status = pthread_mutex_lock(&mutexes[LAB_STATE_PRINT]);
-    if (setStatusIfAnyError(status, LAB_LOCK_SECTION, t)) return param;
+    if (setStatusIfAnyError(status, LAB_LOCK_SECTION, t)) return;
 
     if (isSync)  {
         status = pthread_mutex_unlock(&mutexes[LAB_STATE_READY]);
-        if (setStatusIfAnyError(status, LAB_UNLOCK_SECTION, t)) return param;
+        if (setStatusIfAnyError(status, LAB_UNLOCK_SECTION, t)) return;
     }
 
     for (long i = 0; i < p.iterations * LAB_MUTEX_NUMBER; i++) {
         status = pthread_mutex_lock(&mutexes[currentMutex]); 
-        if (setStatusIfAnyError(status, LAB_LOCK_SECTION, t)) return param;
+        if (setStatusIfAnyError(status, LAB_LOCK_SECTION, t)) return;
 
         currentMutex = (currentMutex + 1) % LAB_MUTEX_NUMBER;
         
         status = pthread_mutex_unlock(&mutexes[currentMutex]);  
-        if (setStatusIfAnyError(status, LAB_UNLOCK_SECTION, t)) return param;
+        if (setStatusIfAnyError(status, LAB_UNLOCK_SECTION, t)) return;
         
         if (currentMutex == LAB_STATE_PRINT) {
             printf("%ld %ld %s\n", id, i / LAB_MUTEX_NUMBER, str);
@@ -128,6 +136,14 @@ void * run(void * param) {
 
     status = pthread_mutex_unlock(&mutexes[LAB_STATE_PRINT]);
     (void) setStatusIfAnyError(status, LAB_END_SECTION, t);
+}
+
+void * run(void * param) {
+    if (param == NULL) return param;
+    threadLabNode *t = (threadLabNode*)param;
+    if (perfEnabled) perfStart(&t->perf);
+    runRounds(t);
+    if (perfEnabled) perfStop(&t->perf);
     return param;
 }
 
@@ -224,6 +240,17 @@ void describeSectionAndError(int section, int status, pthread_t thread) {
     }
 }
 
+/*
+ * Goes to stderr, stdout belongs to the threads' lines
+ */
+void printPerfOfThreads(threadLabNode *threads, long n, long iterations) {
+    for (long i = 0; i < n; ++i) {
+        char label[32];
+        snprintf(label, sizeof(label), "thread %ld", i);
+        printPerf(stderr, label, &threads[i].perf, iterations, "round");
+    }
+}
+
 void runChildrenThreads(long iterations) {
     pthread_mutex_t mutexes[LAB_MUTEX_NUMBER];
     threadLabNode threads[LAB_THREADS_NUMBER];
@@ -257,6 +284,8 @@ void runChildrenThreads(long iterations) {
         exit(LAB_BAD);
     }
 
+    if (perfEnabled) printPerfOfThreads(threads, LAB_THREADS_NUMBER, iterations);
+
     if (deinitMutexes(mutexes, LAB_MUTEX_NUMBER) != LAB_NO_ERROR) 
         exit(LAB_FATAL);
 }
@@ -267,6 +296,25 @@ int isCorrect(long v, char * rep) {
     return strcmp(ns, rep) == 0;
 }
 
+/**
+ * Removes --options from argv, so positional arguments keep their places
+ */
+void parseOptions(int *argc, char *argv[]) {
+    int positional = 1;
+    for (int i = 1; i < *argc; ++i) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            argv[positional++] = arg;
+        } else if (strcmp(arg, "--perf") == 0) {
+            perfEnabled = 1;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    *argc = positional;
+}
+
 long getIterationsNumber(int argc, char **argv) {
     if (argc < 2) return LAB_ITERATION_NUMBER;
 
@@ -286,6 +334,7 @@ long getIterationsNumber(int argc, char **argv) {
 }
 
 int main(int argc, char *argv[]) {
+    parseOptions(&argc, argv);
     long iterations = getIterationsNumber(argc, argv);
     runChildrenThreads(iterations);
     exit(LAB_NO_ERROR);
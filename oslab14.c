@@ -8,6 +8,8 @@
 #include <math.h>
 #include <limits.h>
 
+#include "labperf.h"
+
 #define LAB_NO_ERROR 0
 #define LAB_BAD 1
 
@@ -18,6 +20,8 @@
 #define LAB_FATAL 6
 #define LAB_BAD_ARGS 7
 
+#define LAB_CACHE_LINE 64
+
 #define LAB_THREADS_NUMBER 2
 
 #define LAB_ITERATION_NUMBER 10
@@ -38,7 +42,8 @@ struct _threadLabNode {
     pthread_t thread; 
     int status;
     int section;
-};
+    perfCounters perf; // filled when --perf is given
+} __attribute__((aligned(LAB_CACHE_LINE)));
 
 typedef struct _errorIndexPair errorIndexPair;
 struct _errorIndexPair {
@@ -46,6 +51,8 @@ struct _errorIndexPair {
     long i;
 };
 
+static int perfEnabled = 0; // --perf: count cycles, instructions and misses of both threads
+
 void printError(int code, pthread_t thread, char * what) {
     fprintf(stderr, "Error with thr %lu\n%s; %s\n", thread, what, strerror(code));
 }
@@ -67,9 +74,10 @@ int setStatusIfAnyError(int status, int section, threadLabNode* t) {
     return 0;
 }
 
-void * run(void * param) {
-    if (param == NULL) return param;
-    threadLabNode *t = (threadLabNode*)param;
+/*
+ * Every exit, early ones on errors included, goes back to run, which stops the counters
+ */
+void runRounds(threadLabNode *t) {
     runParams p = t->params;
 
     sem_t  *sems = p.sems;
@@ -81,12 +89,19 @@ void * run(void * param) {
 
     for (int i = 0; i < p.iterations; ++i) {
         int status = sem_wait(semaphoreSecond);
-        if (setStatusIfAnyError(errno, LAB_WAIT, t)) return param;
+        if (setStatusIfAnyError(errno, LAB_WAIT, t)) return;
         printf("%d %s\n", i, str);
         status = sem_post(semaphoreFirst);
-        if (setStatusIfAnyError(errno, LAB_POST, t)) return param;
+        if (setStatusIfAnyError(errno, LAB_POST, t)) return;
     }
+}
 
+void * run(void * param) {
+    if (param == NULL) return param;
+    threadLabNode *t = (threadLabNode*)param;
+    if (perfEnabled) perfStart(&t->perf);
+    runRounds(t);
+    if (perfEnabled) perfStop(&t->perf);
     return param;
 }
 
@@ -170,6 +185,17 @@ void describeSectionAndError(int section, int status, pthread_t thread) {
     }
 }
 
+/*
+ * Goes to stderr, stdout belongs to the threads' lines
+ */
+void printPerfOfThreads(threadLabNode *threads, long n, long iterations) {
+    for (long i = 0; i < n; ++i) {
+        char label[32];
+        snprintf(label, sizeof(label), "thread %ld", i);
+        printPerf(stderr, label, &threads[i].perf, iterations, "round");
+    }
+}
+
 void runChildrenThreads(long iterations) {
     sem_t sems[LAB_THREADS_NUMBER];
     threadLabNode threads[LAB_THREADS_NUMBER];
@@ -203,6 +229,8 @@ void runChildrenThreads(long iterations) {
         exit(LAB_BAD);
     }
 
+    if (perfEnabled) printPerfOfThreads(threads, LAB_THREADS_NUMBER, iterations);
+
     if (destroySemaphores(sems) != LAB_NO_ERROR) exit(LAB_FATAL); 
 }
 
@@ -212,6 +240,25 @@ int isCorrect(long v, char * rep) {
     return strcmp(ns, rep) == 0;
 }
 
+/**
+ * Removes --options from argv, so positional arguments keep their places
+ */
+void parseOptions(int *argc, char *argv[]) {
+    int positional = 1;
+    for (int i = 1; i < *argc; ++i) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            argv[positional++] = arg;
+        } else if (strcmp(arg, "--perf") == 0) {
+            perfEnabled = 1;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    *argc = positional;
+}
+
 long getIterationsNumber(int argc, char **argv) {
     if (argc < 2) return LAB_ITERATION_NUMBER;
 
@@ -231,6 +278,7 @@ long getIterationsNumber(int argc, char **argv) {
 }
 
 int main(int argc, char *argv[]) {
+    parseOptions(&argc, argv);
     long iterations = getIterationsNumber(argc, argv);
     runChildrenThreads(iterations);
     exit(LAB_NO_ERROR);
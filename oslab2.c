@@ -3,6 +3,9 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "labring.h"
 
 #define LAB_SUCCESS ((void*)0)
 #define LAB_BAD_PARAM ((void*)1)
@@ -11,14 +14,22 @@
 #define LAB_THREAD_CREATE_SUCCESS 0
 #define LAB_THREAD_JOIN_SUCCESS 0
 
+#define LAB_RING_RECORDS 1024
+
+static logRing *ring; // NULL when lines go through printf
+
 void * run(void * param) {
     if (param == NULL)
         return (LAB_BAD_PARAM);
     
     char *str = (char*)param;
     int i;
-    for (i=0; i<10; i++) 
-        printf("%d %s\n", i, str);
+    for (i=0; i<10; i++) {
+        if (ring != NULL)
+            logRingPrintf(ring, "%d %s\n", i, str);
+        else
+            printf("%d %s\n", i, str);
+    }
 	return LAB_SUCCESS;
 }
 
@@ -26,9 +37,40 @@ void print_error(int code, pthread_t thread, char * what) {
     fprintf(stderr, "Error: %lu %s: %s\n", thread, what, strerror(code));
 }
 
+/*
+ * Returns the backpressure policy of --ring=block|spin|drop, -1 without --ring
+ */
+int parseRingOption(int argc, char *argv[]) {
+    int policy = -1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ring=block") == 0 || strcmp(argv[i], "--ring") == 0) {
+            policy = LAB_RING_BLOCK;
+        } else if (strcmp(argv[i], "--ring=spin") == 0) {
+            policy = LAB_RING_SPIN;
+        } else if (strcmp(argv[i], "--ring=drop") == 0) {
+            policy = LAB_RING_DROP;
+        } else {
+            fprintf(stderr, "Expected arguments: [ --ring[=block|spin|drop] ]\n");
+            pthread_exit(LAB_FAIL);
+        }
+    }
+    return policy;
+}
+
 int main(int argc, char *argv[]) {
     pthread_t thread;
     pthread_attr_t attr;
+    static logRing lines;
+
+    int policy = parseRingOption(argc, argv);
+    if (policy >= 0) {
+        int code = logRingInit(&lines, STDOUT_FILENO, LAB_RING_RECORDS, policy);
+        if (code != 0) {
+            print_error(code, pthread_self(), "can't start the output ring");
+            pthread_exit(LAB_FAIL);
+        }
+        ring = &lines;
+    }
 
     int code = pthread_attr_init(&attr);
     if (code == ENOMEM) {
@@ -63,6 +105,16 @@ int main(int argc, char *argv[]) {
 
     run("I gave a birth!");
 
+    if (ring != NULL) {
+        code = logRingClose(ring);
+        printLogRingStats(ring, stderr);
+        if (code != 0) {
+            print_error(code, pthread_self(), "can't write output");
+            // pthread_exit from main ends the process with status 0 whatever it is given
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // read oslab1.c for comments
     pthread_attr_destroy(&attr);
     pthread_exit(LAB_SUCCESS);  
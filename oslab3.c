@@ -3,6 +3,13 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+#include "labring.h"
+#include "laburing.h"
 
 #define LAB_NO_ERROR 0
 #define LAB_SOME_ERROR 1
@@ -11,6 +18,30 @@
 #define LAB_CANT_WAIT_FOR_THREADS 4
 #define LAB_BAD_ARGS 5
 #define LAB_BAD_ALLOC 6
+#define LAB_BAD_ATTR 7
+
+#define LAB_CACHE_LINE 64
+
+#define LAB_DIFFERENT_STRINGS 10 // strerror(1) ... strerror(10) repeat in every table
+
+#define LAB_STRINGS_ARENA 0
+#define LAB_STRINGS_COPY 1 // a malloc per string, kept to compare against
+
+#define LAB_OUTPUT_PRINTF 0
+#define LAB_OUTPUT_BUFFERED 1 // lines formatted into a per-thread batch, written with one write()
+#define LAB_OUTPUT_RING 2 // lines pushed into a shared ring, written by one writer thread
+#define LAB_OUTPUT_URING 3 // per-thread batches in registered buffers, written by io_uring
+#define LAB_OUTPUT_WRITEV 4 // numbers formatted per thread, strings written in place with writev()
+
+#define LAB_OUTPUT_BATCH 16384 // bytes, default batch of buffered output
+#define LAB_MAX_LINE 256
+#define LAB_RING_RECORDS 4096 // default records in the ring
+#define LAB_URING_DEPTH 64 // default buffers of io_uring output
+#define LAB_CREATE_BACKOFF_MS 1 // first wait when a thread can't be created for lack of resources
+#define LAB_CREATE_MAX_BACKOFF_MS 128
+#define LAB_CREATE_RETRIES 20 // waits in a row without anything to join before giving up
+
+#define LAB_WRITEV_LINES 341 // IOV_MAX (1024 on linux) / 3, a line is its numbers, its string and a newline
 
 // typedef unsigned int pthread_t;
 // int pthread_create(pthread_t *thr, void * p,  void *(*start_routine)(void*), void * arg);\
@@ -18,25 +49,80 @@
 // void pthread_exit(void *value_ptr);
 //  pthread_t pthread_self(void);
 
+/*
+ * Where buffered threads flush their batches. With lock set a batch is written
+ * whole before another thread writes, so lines are never split or interleaved
+ * even when write() is partial (pipes over PIPE_BUF, terminals). Without it
+ * only regular files keep whole batches together.
+ */
+typedef struct _outputSink {
+    int mode; // LAB_OUTPUT_*
+    int fd;
+    size_t batch;
+    pthread_mutex_t *lock;
+    logRing *ring; // set for ring output, then the fields above are unused
+    uringSink *uring; // set for io_uring output, then only batch is used
+} outputSink;
+
 typedef struct _threadRunParams {
     char **strings;
     int count;
+    outputSink *sink; // NULL for printf
 } runParams;
 
+typedef struct _labOptions {
+    int strings;
+    int stats;
+    int output;
+    size_t batch;
+    int atomicLines;
+    size_t ringSlots;
+    int backpressure;
+    int uringDepth;
+    size_t stack; // bytes of a worker's stack, 0 for the default
+    long guard;   // bytes of its guard area, -1 for the default
+} labOptions;
+
+/*
+ * How thread creation went: EAGAIN (out of threads, memory for stacks or
+ * map count) is answered by joining the oldest worker, which frees its
+ * stack, or by waiting when every started worker is already joined
+ */
+typedef struct _creationStats {
+    double ms;
+    long throttled; // pthread_create calls that returned EAGAIN
+    long earlyJoins;
+    long unjoined;  // most workers holding a stack at once
+} creationStats;
+
+/*
+ * Every thread's string table in one allocation: the pointer arrays of all
+ * threads, then one interned copy of each distinct message they point to
+ */
+typedef struct _stringArena {
+    void *memory;
+} stringArena;
+
 typedef struct _threadLabNode threadLabNode;
 struct _threadLabNode {
     runParams params;
     pthread_t thread; 
     int status;
-};
+    int joined;
+    size_t bytes; // of output
+} __attribute__((aligned(LAB_CACHE_LINE)));
 
 threadLabNode constructNode(runParams p) {
     threadLabNode node;
     node.params = p;
     node.status = LAB_NO_ERROR;
+    node.joined = 0;
+    node.bytes = 0;
     return node;    
 }
 
+void printError(int code, pthread_t thread, char * what);
+
 void freeParams(runParams param) {
     char ** arr = param.strings;
     if (arr == NULL)
@@ -50,6 +136,177 @@ void freeParams(runParams param) {
     free(arr);
 }
 
+/*
+ * Returns LAB_NO_ERROR or errno of write
+ */
+int flushLines(outputSink *sink, char *data, size_t *used) {
+    int code = LAB_NO_ERROR;
+    if (sink->lock != NULL) pthread_mutex_lock(sink->lock);
+    for (size_t done = 0; done < *used; ) {
+        ssize_t w = write(sink->fd, data + done, *used - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) {
+            code = errno;
+            break;
+        }
+        done += w;
+    }
+    if (sink->lock != NULL) pthread_mutex_unlock(sink->lock);
+    *used = 0;
+    return code;
+}
+
+/*
+ * Writes the decimal digits of v to out, returns their count
+ */
+int formatInt(char *out, int v) {
+    char digits[12];
+    int len = 0, neg = v < 0;
+    unsigned int u = neg ? 0u - (unsigned int)v : (unsigned int)v;
+    do {
+        digits[len++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+    int size = 0;
+    if (neg) out[size++] = '-';
+    while (len > 0) out[size++] = digits[--len];
+    return size;
+}
+
+/*
+ * The same line printf("%d %d %s\n") gives, without going through stdio.
+ * out has room for LAB_MAX_LINE bytes, longer strings are cut.
+ */
+int formatLine(char *out, int id, int i, const char *str) {
+    int len = formatInt(out, id);
+    out[len++] = ' ';
+    len += formatInt(out + len, i);
+    out[len++] = ' ';
+    while (*str != '\0' && len < LAB_MAX_LINE - 1) out[len++] = *str++;
+    out[len++] = '\n';
+    return len;
+}
+
+void runBuffered(threadLabNode *tn, runParams p) {
+    char *data = malloc(p.sink->batch);
+    if (data == NULL) {
+        printError(ENOMEM, pthread_self(), "can't allocate output batch");
+        return;
+    }
+    size_t used = 0;
+    int code = LAB_NO_ERROR;
+    int id = (int)tn->thread;
+    for (int i = 0; i < p.count && code == LAB_NO_ERROR; ++i) {
+        if (used + LAB_MAX_LINE > p.sink->batch) code = flushLines(p.sink, data, &used);
+        size_t before = used;
+        used += formatLine(data + used, id, i, p.strings[i]);
+        tn->bytes += used - before;
+    }
+    if (code == LAB_NO_ERROR && used > 0) code = flushLines(p.sink, data, &used);
+    if (code != LAB_NO_ERROR) printError(code, pthread_self(), "can't write output");
+    free(data);
+}
+
+/*
+ * Lines go whole into the ring, the writer thread is the only one touching the fd
+ */
+void runRing(threadLabNode *tn, runParams p) {
+    char line[LAB_MAX_LINE];
+    int id = (int)tn->thread;
+    for (int i = 0; i < p.count; ++i) {
+        int len = formatLine(line, id, i, p.strings[i]);
+        if (logRingPush(p.sink->ring, line, len) == LAB_NO_ERROR) tn->bytes += len;
+    }
+}
+
+/*
+ * Batches are filled right in the registered buffers and written while the
+ * thread goes on with the next one
+ */
+void runUring(threadLabNode *tn, runParams p) {
+    uringSink *u = p.sink->uring;
+    int buffer;
+    char *data = uringGetBuffer(u, &buffer);
+    size_t used = 0;
+    int code = LAB_NO_ERROR;
+    int id = (int)tn->thread;
+    for (int i = 0; i < p.count && code == LAB_NO_ERROR; ++i) {
+        if (used + LAB_MAX_LINE > u->size) {
+            code = uringSubmit(u, buffer, used);
+            data = uringGetBuffer(u, &buffer);
+            used = 0;
+        }
+        int len = formatLine(data + used, id, i, p.strings[i]);
+        used += len;
+        tn->bytes += len;
+    }
+    if (uringSubmit(u, buffer, used) != LAB_NO_ERROR || code != LAB_NO_ERROR)
+        printError(u->error, pthread_self(), "can't write output");
+}
+
+/*
+ * Writes the iovecs whole, retrying partial writes
+ */
+int writevAll(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t w = writev(fd, iov, count);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return errno;
+        while (count > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return LAB_NO_ERROR;
+}
+
+/*
+ * Only "id i " is formatted, the strings are written from the tables
+ */
+void runWritev(threadLabNode *tn, runParams p) {
+    struct iovec *iov = malloc(sizeof(struct iovec) * LAB_WRITEV_LINES * 3);
+    char (*numbers)[32] = malloc(sizeof(*numbers) * LAB_WRITEV_LINES);
+    if (iov == NULL || numbers == NULL) {
+        printError(ENOMEM, pthread_self(), "can't allocate output batch");
+        free(iov);
+        free(numbers);
+        return;
+    }
+    int code = LAB_NO_ERROR;
+    int id = (int)tn->thread;
+    for (int i = 0; i < p.count && code == LAB_NO_ERROR; ) {
+        int count = 0;
+        for (int line = 0; line < LAB_WRITEV_LINES && i < p.count; ++line, ++i) {
+            char *number = numbers[line];
+            int len = formatInt(number, id);
+            number[len++] = ' ';
+            len += formatInt(number + len, i);
+            number[len++] = ' ';
+            iov[count++] = (struct iovec){number, len};
+            iov[count++] = (struct iovec){p.strings[i], strlen(p.strings[i])};
+            iov[count++] = (struct iovec){"\n", 1};
+            tn->bytes += len + iov[count - 2].iov_len + 1;
+        }
+        if (p.sink->lock != NULL) pthread_mutex_lock(p.sink->lock);
+        code = writevAll(p.sink->fd, iov, count);
+        if (p.sink->lock != NULL) pthread_mutex_unlock(p.sink->lock);
+    }
+    if (code != LAB_NO_ERROR) printError(code, pthread_self(), "can't write output");
+    free(iov);
+    free(numbers);
+}
+
+double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
 void * run(void * param) {
     if (param == NULL)
         return param;
@@ -57,8 +314,18 @@ void * run(void * param) {
     threadLabNode * tn = (threadLabNode*)param;
     runParams p = tn->params;
 
+    if (p.sink != NULL) {
+        switch (p.sink->mode) {
+        case LAB_OUTPUT_BUFFERED: runBuffered(tn, p); break;
+        case LAB_OUTPUT_RING: runRing(tn, p); break;
+        case LAB_OUTPUT_URING: runUring(tn, p); break;
+        case LAB_OUTPUT_WRITEV: runWritev(tn, p); break;
+        }
+        return param;
+    }
     for (int i = 0; i < p.count; ++i) {
-        printf("%d %d %s\n",tn->thread, i, p.strings[i]);
+        int len = printf("%d %d %s\n", (int)tn->thread, i, p.strings[i]);
+        if (len > 0) tn->bytes += len;
         if (errno != LAB_NO_ERROR) {
             printError(errno, pthread_self(), "");
             break;
@@ -74,8 +341,8 @@ void printError(int code, pthread_t thread, char * what) {
 
 runParams makeStringArrayOfLength(int n) {
     char ** arr = malloc(sizeof(char*) * n);
-    if (arr == null)
-        return (runParams) {NULL, 0};
+    if (arr == NULL)
+        return (runParams){NULL, 0, NULL};
 
     for (int i = 0; i < n; ++i) {
         char * str = strerror((i % 10) + 1);
@@ -83,7 +350,7 @@ runParams makeStringArrayOfLength(int n) {
         arr[i] = malloc(sizeof(char) * len + 1);
 
         if (arr[i] == NULL) 
-            return (runParams){NULL, 0};
+            return (runParams){NULL, 0, NULL};
 
         memcpy(arr[i], str, sizeof(char) * len);
         arr[i][len] = '\0';
@@ -92,9 +359,41 @@ runParams makeStringArrayOfLength(int n) {
     runParams params;
     params.strings = arr;
     params.count = n;
+    params.sink = NULL;
     return params;
 }
 
+/*
+ * Fills the string tables of all threads from one arena, returns LAB_NO_ERROR or LAB_BAD_ALLOC
+ */
+int initArenaThreads(stringArena *arena, threadLabNode *threads, int n, int *arr) {
+    size_t pointers = 0, text = 0;
+    for (int i = 0; i < n; ++i) pointers += arr[i];
+    for (int s = 0; s < LAB_DIFFERENT_STRINGS; ++s) text += strlen(strerror(s + 1)) + 1;
+
+    arena->memory = malloc(sizeof(char*) * pointers + text);
+    if (arena->memory == NULL)
+        return LAB_BAD_ALLOC;
+
+    char **table = arena->memory;
+    char *interned[LAB_DIFFERENT_STRINGS];
+    char *next = (char*)(table + pointers);
+    for (int s = 0; s < LAB_DIFFERENT_STRINGS; ++s) {
+        const char *str = strerror(s + 1);
+        size_t len = strlen(str) + 1;
+        memcpy(next, str, len);
+        interned[s] = next;
+        next += len;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < arr[i]; ++j) table[j] = interned[j % LAB_DIFFERENT_STRINGS];
+        threads[i] = constructNode((runParams){arr[i] > 0 ? table : NULL, arr[i], NULL});
+        table += arr[i];
+    }
+    return LAB_NO_ERROR;
+}
+
 int initThreads(threadLabNode *threads, int n, int *arr) {
     for (int i = 0; i < n; ++i) {
         runParams params = makeStringArrayOfLength(arr[i]);
@@ -107,19 +406,55 @@ int initThreads(threadLabNode *threads, int n, int *arr) {
     return LAB_NO_ERROR;
 }
 
-threadLabNode* runThreads(threadLabNode *list, int n) {
-    for (int i = 0; i < n; ++i) {
+void sleepMs(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+threadLabNode* runThreads(threadLabNode *list, int n, pthread_attr_t *attr, creationStats *stats) {
+    int oldest = 0; // first worker that may still be unjoined
+    long backoff = LAB_CREATE_BACKOFF_MS;
+    int retries = 0;
+    for (int i = 0; i < n; ) {
         threadLabNode *curr = &(list[i]);
-        int code = pthread_create(&(curr->thread), NULL, run, curr);
+        int code = pthread_create(&(curr->thread), attr, run, curr);
         curr->status = code;
-        if (code != LAB_NO_ERROR)
+        if (code == LAB_NO_ERROR) {
+            if (i + 1 - oldest > stats->unjoined) stats->unjoined = i + 1 - oldest;
+            backoff = LAB_CREATE_BACKOFF_MS;
+            retries = 0;
+            ++i;
+            continue;
+        }
+        if (code != EAGAIN)
             return curr;
+
+        stats->throttled++;
+        while (oldest < i && (list[oldest].joined || list[oldest].status != LAB_NO_ERROR)) ++oldest;
+        if (oldest < i) {
+            threadLabNode *done = &(list[oldest++]);
+            done->status = pthread_join(done->thread, NULL);
+            if (done->status != LAB_NO_ERROR)
+                return done;
+            done->joined = 1;
+            stats->earlyJoins++;
+        } else if (retries++ < LAB_CREATE_RETRIES) {
+            sleepMs(backoff);
+            if (backoff < LAB_CREATE_MAX_BACKOFF_MS) backoff *= 2;
+        } else {
+            return curr;
+        }
     }
 
     return NULL;
 }
 
-void freeThreads(threadLabNode *arr, int n) {
+void freeThreads(threadLabNode *arr, int n, stringArena *arena) {
+    if (arena->memory != NULL) {
+        free(arena->memory);
+        arena->memory = NULL;
+        return;
+    }
     for(int i = 0; i < n; ++i) {
         freeParams(arr[i].params);
     }
@@ -132,12 +467,13 @@ threadLabNode* waitUntilAllThreadsFinish(threadLabNode *runningJoinableThreads,
     for (int i = 0; i < n; ++i) {
         threadLabNode *curr = &(runningJoinableThreads[i]);
         int status = curr->status;
-        if (status == LAB_NO_ERROR) {
+        if (status == LAB_NO_ERROR && !curr->joined) {
             threadLabNode * ret = NULL;
             int code = pthread_join(curr->thread, (void**)(&ret));
             curr->status = code;
 
             if (code == LAB_NO_ERROR) {
+                curr->joined = 1;
                 /*No errors, it's just fine as ESRCH*/
             } 
             #ifdef LAB_ALLOW_MN_JOIN // whatever it's allowed for n threads to wait for same m threads or not
@@ -162,13 +498,153 @@ threadLabNode* waitUntilAllThreadsFinish(threadLabNode *runningJoinableThreads,
 void fillArray(int * arr, int n, char **argv) {
     for (int i = 0; i < n; ++i) {
         arr[i] = atoi(argv[i]);
+        if (arr[i] < 0) {
+            printf("r_%d must not be negative\n", i + 1);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+}
+
+/**
+ * Removes --options from argv, so positional arguments keep their places
+ */
+labOptions parseOptions(int *argc, char *argv[]) {
+    labOptions options = {LAB_STRINGS_ARENA, 0, LAB_OUTPUT_PRINTF, LAB_OUTPUT_BATCH, 0, LAB_RING_RECORDS, LAB_RING_BLOCK, LAB_URING_DEPTH, 0, -1};
+    int positional = 1;
+    for (int i = 1; i < *argc; ++i) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            argv[positional++] = arg;
+        } else if (strcmp(arg, "--strings=arena") == 0) {
+            options.strings = LAB_STRINGS_ARENA;
+        } else if (strcmp(arg, "--strings=copy") == 0) {
+            options.strings = LAB_STRINGS_COPY;
+        } else if (strcmp(arg, "--output=printf") == 0) {
+            options.output = LAB_OUTPUT_PRINTF;
+        } else if (strcmp(arg, "--output=buffered") == 0) {
+            options.output = LAB_OUTPUT_BUFFERED;
+        } else if (strcmp(arg, "--output=ring") == 0) {
+            options.output = LAB_OUTPUT_RING;
+        } else if (strcmp(arg, "--output=uring") == 0) {
+            options.output = LAB_OUTPUT_URING;
+        } else if (strcmp(arg, "--output=writev") == 0) {
+            options.output = LAB_OUTPUT_WRITEV;
+        } else if (strncmp(arg, "--uring-depth=", 14) == 0) {
+            long depth = strtol(arg + 14, NULL, 10);
+            if (depth < 1 || depth > 4096) {
+                printf("uring depth must be 1 ... 4096 buffers\n");
+                exit(LAB_BAD_ARGS);
+            }
+            options.uringDepth = depth;
+        } else if (strncmp(arg, "--ring-slots=", 13) == 0) {
+            long slots = strtol(arg + 13, NULL, 10);
+            if (slots < 2) {
+                printf("ring must have at least 2 slots\n");
+                exit(LAB_BAD_ARGS);
+            }
+            options.ringSlots = slots;
+        } else if (strcmp(arg, "--backpressure=block") == 0) {
+            options.backpressure = LAB_RING_BLOCK;
+        } else if (strcmp(arg, "--backpressure=spin") == 0) {
+            options.backpressure = LAB_RING_SPIN;
+        } else if (strcmp(arg, "--backpressure=drop") == 0) {
+            options.backpressure = LAB_RING_DROP;
+        } else if (strncmp(arg, "--batch=", 8) == 0) {
+            long batch = strtol(arg + 8, NULL, 10);
+            if (batch < LAB_MAX_LINE) {
+                printf("batch must be at least %d bytes\n", LAB_MAX_LINE);
+                exit(LAB_BAD_ARGS);
+            }
+            options.batch = batch;
+        } else if (strcmp(arg, "--atomic-lines") == 0) {
+            options.atomicLines = 1;
+        } else if (strncmp(arg, "--stack=", 8) == 0) {
+            long stack = strtol(arg + 8, NULL, 10);
+            if (stack < PTHREAD_STACK_MIN) {
+                printf("stack must be at least %ld bytes\n", (long)PTHREAD_STACK_MIN);
+                exit(LAB_BAD_ARGS);
+            }
+            options.stack = stack;
+        } else if (strncmp(arg, "--guard=", 8) == 0) {
+            options.guard = strtol(arg + 8, NULL, 10);
+            if (options.guard < 0) {
+                printf("guard must not be negative\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strcmp(arg, "--stats") == 0) {
+            options.stats = 1;
+        } else {
+            printf("unknown option: %s\n", arg);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    *argc = positional;
+    if (options.atomicLines && options.output != LAB_OUTPUT_BUFFERED && options.output != LAB_OUTPUT_WRITEV) {
+        printf("--atomic-lines needs --output=buffered or writev, other lines are always whole\n");
+        exit(LAB_BAD_ARGS);
+    }
+    return options;
+}
+
+
+/*
+ * A "Name:  value kB" field of /proc/self/status, -1 if there is none
+ */
+long procStatusKb(const char *name) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return -1;
+    char line[256];
+    long kb = -1;
+    size_t len = strlen(name);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, name, len) == 0 && line[len] == ':') {
+            kb = strtol(line + len + 1, NULL, 10);
+            break;
+        }
     }
+    fclose(f);
+    return kb;
+}
+
+/*
+ * On stderr, stdout belongs to the threads' lines
+ */
+void printStats(labOptions options, outputSink *sink, int n, creationStats *creation, double tables, double teardown,
+                double lines, double bytes, double wall) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "strings=%s tables=%.3fms free=%.3fms peak rss=%ldKB peak vm=%ldKB\n",
+        options.strings == LAB_STRINGS_ARENA ? "arena" : "copy", tables, teardown, usage.ru_maxrss, procStatusKb("VmPeak"));
+    fprintf(stderr, "threads=%d stack=", n);
+    if (options.stack > 0) fprintf(stderr, "%zu", options.stack);
+    else fprintf(stderr, "default");
+    fprintf(stderr, " guard=");
+    if (options.guard >= 0) fprintf(stderr, "%ld", options.guard);
+    else fprintf(stderr, "default");
+    fprintf(stderr, " create=%.3fms creates/sec=%.6g most unjoined=%ld throttled=%ld early joins=%ld\n", creation->ms,
+        creation->ms > 0 ? n / creation->ms * 1000 : 0, creation->unjoined, creation->throttled, creation->earlyJoins);
+    if (options.output == LAB_OUTPUT_BUFFERED)
+        fprintf(stderr, "output=buffered batch=%zu atomic lines=%s", options.batch, options.atomicLines ? "yes" : "no");
+    else if (options.output == LAB_OUTPUT_WRITEV)
+        fprintf(stderr, "output=writev atomic lines=%s", options.atomicLines ? "yes" : "no");
+    else if (options.output == LAB_OUTPUT_RING)
+        fprintf(stderr, "output=ring");
+    else if (options.output == LAB_OUTPUT_URING)
+        fprintf(stderr, "output=uring batch=%zu", options.batch);
+    else
+        fprintf(stderr, "output=printf");
+    fprintf(stderr, " lines=%.0f bytes=%.0f wall=%.3fms lines/sec=%.6g MB/s=%.6g\n", lines, bytes, wall,
+        wall > 0 ? lines / wall * 1000 : 0, wall > 0 ? bytes / wall / 1000 : 0);
+    if (sink->ring != NULL) printLogRingStats(sink->ring, stderr);
+    if (sink->uring != NULL) printUringStats(sink->uring, stderr);
 }
 
 int main(int argc, char *argv[]) {
     // no static
     // make code scalable
     // run_child_thread must return code errors, with semantic and handling
+    labOptions options = parseOptions(&argc, argv);
     int n;
     if (argc >= 2) {
         n = atoi(argv[1]);
@@ -177,35 +653,118 @@ int main(int argc, char *argv[]) {
             exit(LAB_BAD_ARGS);
         }
     } else {
-        printf("Expected arguments: n r_1 ... r_n\n");
+        printf("Expected arguments: n r_1 ... r_n [ --strings=arena|copy ] [ --output=printf|buffered [ --batch=bytes ] [ --atomic-lines ] ]\n"
+               "                    [ --output=writev [ --atomic-lines ] ] [ --output=uring [ --batch=bytes ] [ --uring-depth=buffers ] ]\n"
+               "                    [ --output=ring [ --ring-slots=records ] [ --backpressure=block|spin|drop ] ]\n"
+               "                    [ --stack=bytes ] [ --guard=bytes ] [ --stats ]\n");
         exit(LAB_BAD_ARGS);
     }
     
-    int arr[n];
+    int *arr = malloc(sizeof(int) * (n > 0 ? n : 1));
+    threadLabNode *threads = aligned_alloc(LAB_CACHE_LINE, sizeof(threadLabNode) * (n > 0 ? n : 1));
+    if (arr == NULL || threads == NULL) {
+        printError(ENOMEM, pthread_self(), "can't allocate the thread table");
+        exit(LAB_BAD_ALLOC);
+    }
     fillArray(arr, n,  argv + 2);
 
-    threadLabNode threads[n];
-    int index;
-    if ((index = initThreads(threads, n, arr)) != LAB_NO_ERROR) {
-        printError(errno, pthread_self(), "can't allocate memory for strings for threads");
-        freeThreads(threads, index - 1);
-        exit(LAB_BAD_ALLOC);
+    pthread_attr_t attr;
+    int code = pthread_attr_init(&attr);
+    if (code == LAB_NO_ERROR && options.stack > 0) code = pthread_attr_setstacksize(&attr, options.stack);
+    if (code == LAB_NO_ERROR && options.guard >= 0) code = pthread_attr_setguardsize(&attr, options.guard);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't set thread stack attributes");
+        exit(LAB_BAD_ATTR);
+    }
+
+    stringArena arena = {NULL};
+    double begin = nowMs();
+    if (options.strings == LAB_STRINGS_ARENA) {
+        if (initArenaThreads(&arena, threads, n, arr) != LAB_NO_ERROR) {
+            printError(ENOMEM, pthread_self(), "can't allocate memory for strings for threads");
+            exit(LAB_BAD_ALLOC);
+        }
+    } else {
+        int index;
+        if ((index = initThreads(threads, n, arr)) != LAB_NO_ERROR) {
+            printError(errno, pthread_self(), "can't allocate memory for strings for threads");
+            freeThreads(threads, index - 1, &arena);
+            exit(LAB_BAD_ALLOC);
+        }
+    }
+    double tables = nowMs() - begin;
+
+    pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+    logRing ring;
+    uringSink uring;
+    if (options.output == LAB_OUTPUT_URING) {
+        fflush(stdout); // the writes start from the current offset
+        int code = uringOpen(&uring, STDOUT_FILENO, options.uringDepth, options.batch);
+        if (code != LAB_NO_ERROR) {
+            // the same whole batches one after another, written by the threads
+            fprintf(stderr, "io_uring output unavailable (%s), writing batches with write()\n", strerror(code));
+            options.output = LAB_OUTPUT_BUFFERED;
+            options.atomicLines = 1;
+        }
+    }
+    outputSink sink = {options.output, STDOUT_FILENO, options.batch, options.atomicLines ? &outputLock : NULL, NULL,
+        options.output == LAB_OUTPUT_URING ? &uring : NULL};
+    double lines = 0, bytes = 0;
+    for (int i = 0; i < n; ++i) {
+        if (options.output != LAB_OUTPUT_PRINTF) threads[i].params.sink = &sink;
+        lines += arr[i];
+    }
+    fflush(stdout); // nothing buffered by stdio may land after our writes
+    begin = nowMs();
+    if (options.output == LAB_OUTPUT_RING) {
+        int code = logRingInit(&ring, STDOUT_FILENO, options.ringSlots, options.backpressure);
+        if (code != LAB_NO_ERROR) {
+            printError(code, pthread_self(), "can't start the output ring");
+            freeThreads(threads, n, &arena);
+            exit(code == ENOMEM ? LAB_BAD_ALLOC : LAB_CANT_CREATE_THREADS);
+        }
+        sink.ring = &ring;
     }
     
-    threadLabNode * problem = runThreads(threads, n);
+    creationStats creation = {0, 0, 0, 0};
+    double created = nowMs();
+    threadLabNode * problem = runThreads(threads, n, &attr, &creation);
+    creation.ms = nowMs() - created;
     if (problem != NULL) {
         printError(problem->status, problem->thread, "thread creation problem, calling exit");
-        freeThreads(threads, n);
+        freeThreads(threads, n, &arena);
         exit(LAB_CANT_CREATE_THREADS);
     } 
 
     problem = waitUntilAllThreadsFinish(threads, n);
     if (problem != NULL) {
         printError(problem->status, problem->thread, "couldn't wait for this thread due to some error");
-        freeThreads(threads, n);
+        freeThreads(threads, n, &arena);
         exit(LAB_CANT_WAIT_FOR_THREADS);
     }
 
-    freeThreads(threads, n);
+    fflush(stdout); // printf lines still in the stdio buffer are part of the run
+    int outputError = LAB_NO_ERROR;
+    if (sink.ring != NULL) {
+        outputError = logRingClose(&ring);
+        if (outputError != LAB_NO_ERROR) printError(outputError, pthread_self(), "can't write output");
+    }
+    if (sink.uring != NULL) {
+        outputError = uringClose(&uring);
+        if (outputError != LAB_NO_ERROR) printError(outputError, pthread_self(), "can't write output");
+    }
+    double wall = nowMs() - begin;
+    for (int i = 0; i < n; ++i) bytes += threads[i].bytes;
+
+    begin = nowMs();
+    freeThreads(threads, n, &arena);
+    double teardown = nowMs() - begin;
+    if (options.stats)
+        printStats(options, &sink, n, &creation, tables, teardown, lines, bytes, wall);
+    pthread_attr_destroy(&attr);
+    free(threads);
+    free(arr);
+    if (outputError != LAB_NO_ERROR)
+        exit(LAB_SOME_ERROR);
     pthread_exit(LAB_NO_ERROR);  
 }
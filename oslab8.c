@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <pthread.h>
@@ -5,6 +6,17 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "labpi.h"
+#include "labcpu.h"
+#include "labseq.h"
+#include "labcache.h"
+#include "labtune.h"
+#include "labperf.h"
 
 #define LAB_NO_ERROR 0
 #define LAB_SOME_ERROR 1
@@ -14,9 +26,31 @@
 #define LAB_CANT_WAIT_FOR_THREADS 4
 #define LAB_BAD_ARGS 5
 #define LAB_BAD_ALLOC 6
+#define LAB_CANT_CACHE 7
+
+#define LAB_CACHE_LINE 64
 
 #define LAB_ITERATION_NUMBER 100000000
-#define LAB_MAX_THREADS_NUMBER 32
+#define LAB_CHUNK 65536
+#define LAB_BIG_DIGITS 1000
+#define LAB_PROGRESS_SLICE (1L << 20) // indexes between progress updates of an interleaved thread
+#define LAB_BUDGET_BLOCK 65536 // indexes claimed at a time in time budget mode
+
+#define LAB_SCHEDULE_INTERLEAVED 0
+#define LAB_SCHEDULE_STEAL 1
+
+#define LAB_WORKERS_THREADS 0
+#define LAB_WORKERS_PROCESSES 1
+#define LAB_MAX_RERUNS 3 // times a crashed worker process is forked again
+
+#define LAB_TUNE_OFF 0
+#define LAB_TUNE_LOAD 1  // load the host config, calibrate if there is none
+#define LAB_TUNE_FORCE 2 // calibrate again
+
+#define LAB_GIVEN_KERNEL 1
+#define LAB_GIVEN_SIMD 2
+#define LAB_GIVEN_SCHEDULE 4
+#define LAB_GIVEN_CHUNK 8
 
 // #define LAB_DEBUG
 
@@ -25,29 +59,225 @@
 // int pthread_join(pthread_t thread, void **status);
 // void pthread_exit(void *value_ptr);
 
+/*
+ * Chunks [top, bottom) still owned by a thread. The owner takes chunks from the top,
+ * thieves take the bottom half.
+ */
+typedef struct _chunkDeque {
+    pthread_mutex_t lock;
+    long top;
+    long bottom;
+} __attribute__((aligned(LAB_CACHE_LINE))) chunkDeque;
+
+typedef struct _stealScheduler {
+    chunkDeque *deques;
+    long n;
+    long chunkSize;
+    long total; // indexes of the series to sum
+} stealScheduler;
+
 typedef struct _threadRunParams {
     unsigned long startIndex;
     unsigned long count;
     long iterationsNumber;
-    double result;
+    leibnizSumFunc sum;
+    int cpu; // -1 if thread is not pinned
+    stealScheduler *scheduler; // NULL for interleaved split
+    int accumulator;
+    double *blocks; // sums of LAB_REDUCTION_BLOCK indexes, NULL unless reduction is reproducible
+    long firstBlock; // blocks below it are already summed
+    long total;
 } runParams;
+
+/*
+ * Written by the worker only, kept on its own cache line
+ */
+typedef struct _threadRunState {
+    labWide wide; // result in the wide type, kept for every accumulator
+    double result;
+    double seconds; // busy time
+    long done; // indexes summed by this thread
+    long steals;
+    double started; // when the worker began to run
+} __attribute__((aligned(LAB_CACHE_LINE))) runState;
+
 typedef struct _threadLabNode threadLabNode;
 struct _threadLabNode {
     runParams params;
     pthread_t thread; 
     int status;
-};
+    runState state;
+    seqSlot progress; // terms and sum so far, read by the progress reporter
+    double launched; // when the thread was created or the process forked
+    perfCounters perf; // of the worker, filled when --perf is given
+} __attribute__((aligned(LAB_CACHE_LINE)));
 
 threadLabNode constructNode(runParams p) {
     threadLabNode node;
+    memset(&node, 0, sizeof(node));
     node.params = p;
     node.status = LAB_NO_ERROR;
     return node;    
 }
 
-double LeibnizPi(double i) {
-    double f = floor(i);
-    return pow(-1, f) / (2*i + 1.0);
+typedef struct _labOptions {
+    int simd;
+    int kernel;
+    int affinity;
+    int schedule;
+    long chunk;
+    int stats;
+    double target; // absolute error to reach, 0 if iterations are given
+    int digits;
+    int correction; // terms of the tail expansion added in target mode, LAB_CORRECTION_AUTO to pick them
+    int reproducible;
+    double progress; // seconds between progress reports, 0 for SIGUSR1 only
+    double budget; // seconds to run for instead of an iteration count, 0 if not set
+    char *cache; // partial sum cache path prefix, NULL if not used
+    int workers;
+    int tune; // LAB_TUNE_*
+    char *tuneFile; // NULL for the per-host default
+    int perf; // count cycles, instructions and misses of every worker
+} labOptions;
+
+static labOptions options = {LAB_SIMD_AUTO, LAB_KERNEL_LEIBNIZ, LAB_AFFINITY_NONE, LAB_SCHEDULE_INTERLEAVED, LAB_CHUNK, 0,
+                             0.0, 0, LAB_CORRECTION_AUTO, 0, 0.0, 0.0, NULL, LAB_WORKERS_THREADS, LAB_TUNE_OFF, NULL, 0};
+
+/*
+ * Threads used for "auto" when the run is tuned, 0 otherwise
+ */
+static long tunedThreads;
+
+/*
+ * Time budget mode: blocks of LAB_BUDGET_BLOCK indexes are claimed in order until the deadline
+ */
+static double deadline;
+static long claimedBlocks;
+
+void printError(int code, pthread_t thread, char * what) {
+    fprintf(stderr, "Error with thr %lu\n%s; %s\n", thread, what, strerror(code));
+}
+
+/*
+ * Deques split chunks [first, total / chunkSize) evenly
+ */
+stealScheduler *createScheduler(long n, long first, long total, long chunkSize) {
+    stealScheduler *s = malloc(sizeof(stealScheduler));
+    if (s == NULL) return NULL;
+    s->deques = aligned_alloc(LAB_CACHE_LINE, sizeof(chunkDeque) * n);
+    if (s->deques == NULL) {
+        free(s);
+        return NULL;
+    }
+
+    s->n = n;
+    s->chunkSize = chunkSize;
+    s->total = total;
+    long chunks = (total + chunkSize - 1) / chunkSize - first;
+    for (long i = 0; i < n; ++i) {
+        pthread_mutex_init(&s->deques[i].lock, NULL);
+        s->deques[i].top = first + chunks * i / n;
+        s->deques[i].bottom = first + chunks * (i + 1) / n;
+    }
+    return s;
+}
+
+void destroyScheduler(stealScheduler *s) {
+    if (s == NULL) return;
+    for (long i = 0; i < s->n; ++i) pthread_mutex_destroy(&s->deques[i].lock);
+    free(s->deques);
+    free(s);
+}
+
+/*
+ * Returns next chunk of thread id, stealing half of the work of some other thread
+ * if own deque is empty, or -1 if no work is left anywhere
+ */
+long nextChunk(stealScheduler *s, long id, long *steals) {
+    chunkDeque *own = &s->deques[id];
+    pthread_mutex_lock(&own->lock);
+    long chunk = own->top < own->bottom ? own->top++ : -1;
+    pthread_mutex_unlock(&own->lock);
+    if (chunk >= 0) return chunk;
+
+    for (long i = 1; i < s->n; ++i) {
+        chunkDeque *victim = &s->deques[(id + i) % s->n];
+        pthread_mutex_lock(&victim->lock);
+        long left = victim->bottom - victim->top;
+        long from = victim->bottom - (left + 1) / 2;
+        long to = victim->bottom;
+        if (left > 0) victim->bottom = from;
+        pthread_mutex_unlock(&victim->lock);
+        if (left <= 0) continue;
+
+        (*steals)++;
+        pthread_mutex_lock(&own->lock);
+        own->top = from + 1;
+        own->bottom = to;
+        pthread_mutex_unlock(&own->lock);
+        return from;
+    }
+    return -1;
+}
+
+double runStealing(runParams *p, runState *state, seqSlot *progress) {
+    stealScheduler *s = p->scheduler;
+    double res = 0;
+    long chunk;
+    while ((chunk = nextChunk(s, p->startIndex, &state->steals)) >= 0) {
+        long from = chunk * s->chunkSize;
+        long count = from + s->chunkSize > s->total ? s->total - from : s->chunkSize;
+        double begin = labNow();
+        if (p->blocks != NULL) {
+            p->blocks[chunk] = compensatedSum(p->sum, from, count);
+            res += p->blocks[chunk];
+        } else {
+            res += p->sum(from, 1, count);
+        }
+        state->seconds += labNow() - begin;
+        state->done += count;
+        seqPublish(progress, state->done * kernels[options.kernel].termsPerIndex, res);
+    }
+    return res;
+}
+
+/*
+ * Thread i sums blocks first + i, first + i + n... into p->blocks
+ */
+double runBlocks(runParams *p, runState *state, seqSlot *progress) {
+    double res = 0;
+    double begin = labNow();
+    for (long b = p->firstBlock + p->startIndex; b * LAB_REDUCTION_BLOCK < p->total; b += p->count) {
+        long from = b * LAB_REDUCTION_BLOCK;
+        long count = from + LAB_REDUCTION_BLOCK > p->total ? p->total - from : LAB_REDUCTION_BLOCK;
+        p->blocks[b] = compensatedSum(p->sum, from, count);
+        res += p->blocks[b];
+        state->done += count;
+        seqPublish(progress, state->done * kernels[options.kernel].termsPerIndex, res);
+    }
+    state->seconds = labNow() - begin;
+    return res;
+}
+
+/*
+ * Every claimed block is finished, so the summed indexes are always a prefix
+ * of the series. A thread stops claiming when its last block time says
+ * the next one would end past the deadline.
+ */
+double runBudget(runParams *p, runState *state, seqSlot *progress) {
+    double res = 0;
+    double begin = labNow(), now = begin, perBlock = 0;
+    while (now + perBlock < deadline) {
+        long block = __atomic_fetch_add(&claimedBlocks, 1, __ATOMIC_RELAXED);
+        res += p->sum((double)block * LAB_BUDGET_BLOCK, 1, LAB_BUDGET_BLOCK);
+        state->done += LAB_BUDGET_BLOCK;
+        seqPublish(progress, state->done * kernels[options.kernel].termsPerIndex, res);
+        double after = labNow();
+        perBlock = after - now;
+        now = after;
+    }
+    state->seconds = now - begin;
+    return res;
 }
 
 void * run(void * param) {
@@ -56,28 +286,48 @@ void * run(void * param) {
     
     threadLabNode * tn = (threadLabNode*)param;
     runParams p = tn->params;
+    runState state = {0, 0.0, 0.0, 0, 0, labNow()};
+    if (p.cpu >= 0) {
+        int code = pinThreadToCpu(pthread_self(), p.cpu);
+        if (code != LAB_NO_ERROR) printError(code, pthread_self(), "can't pin thread, running unpinned");
+    }
+    if (options.perf) perfStart(&tn->perf);
     
-    double res = 0;
-    double x = p.startIndex;
-    
-    for (long i = 0; i < p.iterationsNumber; ++i) {
-        res += LeibnizPi(x);
-        x += p.count;
+    if (options.budget > 0) {
+        state.result = runBudget(&p, &state, &tn->progress);
+    } else if (p.scheduler != NULL) {
+        state.result = runStealing(&p, &state, &tn->progress);
+    } else if (p.blocks != NULL) {
+        state.result = runBlocks(&p, &state, &tn->progress);
+    } else if (p.accumulator != LAB_ACC_DOUBLE) {
+        double begin = labNow();
+        state.wide = seriesSumWide(options.kernel, p.accumulator, p.startIndex, p.count, p.iterationsNumber);
+        state.result = (double)state.wide;
+        state.seconds = labNow() - begin;
+        state.done = p.iterationsNumber;
+    } else {
+        double begin = labNow();
+        while (state.done < p.iterationsNumber) {
+            long count = p.iterationsNumber - state.done < LAB_PROGRESS_SLICE ? p.iterationsNumber - state.done : LAB_PROGRESS_SLICE;
+            state.result += p.sum(p.startIndex + (double)state.done * p.count, p.count, count);
+            state.done += count;
+            seqPublish(&tn->progress, state.done * kernels[options.kernel].termsPerIndex, state.result);
+        }
+        state.seconds = labNow() - begin;
     }
 #ifdef LAB_DEBUG
-    printf("%d %.15g\n", p.startIndex, 4 * res);
+    printf("%d %.15g\n", p.startIndex, 4 * state.result);
 #endif
-    tn->params.result = res;
+    if (options.perf) perfStop(&tn->perf);
+    if (p.accumulator == LAB_ACC_DOUBLE) state.wide = state.result;
+    tn->state = state;
     return param;
 }
 
-void printError(int code, pthread_t thread, char * what) {
-    fprintf(stderr, "Error with thr %lu\n%s; %s\n", thread, what, strerror(code));
-}
-
 threadLabNode* runThreads(threadLabNode *list, long n) {
     for (long i = 0; i < n; ++i) {
         threadLabNode *curr = &(list[i]);
+        curr->launched = labNow();
         int code = pthread_create(&(curr->thread), NULL, run, curr);
         curr->status = code;
         
@@ -112,15 +362,34 @@ threadLabNode* waitUntilAllThreadsFinish(threadLabNode *runningJoinableThreads,
 
 double collectResults(threadLabNode *finishedThreads, long n) {
     double res = 0;
-    for (long i = 0; i < n; ++i) res += finishedThreads[i].params.result;
+    for (long i = 0; i < n; ++i) res += finishedThreads[i].state.result;
+    return res;
+}
+
+labWide collectWideResults(threadLabNode *finishedThreads, long n) {
+    labWide res = 0;
+    for (long i = 0; i < n; ++i) res += finishedThreads[i].state.wide;
     return res;
 }
 
-void initThreads(threadLabNode *threads, long n, long iterations) {
+long indexesPerThread(long iterations) {
+    return (iterations + kernels[options.kernel].termsPerIndex - 1) / kernels[options.kernel].termsPerIndex;
+}
+
+/*
+ * Thread i sums indexes i, i + n, i + 2n... below total
+ */
+void initThreads(threadLabNode *threads, long n, long total, stealScheduler *scheduler, int accumulator, double *blocks, long firstBlock) {
+    leibnizSumFunc sum = leibnizSumFor(options.kernel, options.simd);
+    int cpuCount = 0;
+    labCpu *cpus = options.affinity == LAB_AFFINITY_NONE ? NULL : planAffinity(options.affinity, &cpuCount);
     for (long i = 0; i < n; ++i) {
-        runParams params = {(unsigned long)i, (unsigned long)n, iterations, 0.0};
+        int cpu = cpuCount > 0 ? cpus[i % cpuCount].id : -1;
+        long indexes = i < total ? (total - i + n - 1) / n : 0;
+        runParams params = {(unsigned long)i, (unsigned long)n, indexes, sum, cpu, scheduler, accumulator, blocks, firstBlock, total};
         threads[i] = constructNode(params);
     }
+    free(cpus);
 }
 
 int isCorrect(long v, char * rep) {
@@ -129,32 +398,208 @@ int isCorrect(long v, char * rep) {
     return strcmp(ns, rep) == 0;
 }
 
-void initAndMayBeDie(int argc, char *argv[], long *n, long *iterations) { //simplify next 
-    if (argc < 2) {
-        printf("args: threadsNumber [ iterationsNumber ]\n");
-        exit(LAB_BAD_ARGS);
+/*
+ * Takes the tuned config for every setting not given on the command line;
+ * the tuned chunk is used by work stealing, so it becomes the default schedule
+ * where stealing is allowed
+ */
+void applyTune(int given) {
+    if (options.tune == LAB_TUNE_OFF) {
+        if (options.tuneFile != NULL) {
+            printf("--tune-file needs --tune\n");
+            exit(LAB_BAD_ARGS);
+        }
+        return;
     }
-    *n = strtol(argv[1], (char **)NULL, 10);
-    if ((*n) > LAB_MAX_THREADS_NUMBER) {
-        printf("Max threads number is: %d\n", LAB_MAX_THREADS_NUMBER);
+    char path[PATH_MAX];
+    int code = tunePath(path, sizeof(path), options.tuneFile);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't name tune file");
         exit(LAB_BAD_ARGS);
     }
+    tuneConfig tuned;
+    int calibrated;
+    code = loadOrCalibrate(path, options.tune == LAB_TUNE_FORCE, &tuned, &calibrated, options.stats ? stdout : NULL);
+    if (code != LAB_NO_ERROR) printError(code, pthread_self(), "can't save tune file, using the calibration once");
+
+    tunedThreads = tuned.threads;
+    if (!(given & LAB_GIVEN_KERNEL) && !isBigKernel(options.kernel)) options.kernel = tuned.kernel;
+    if (!(given & LAB_GIVEN_SIMD)) options.simd = tuned.simd;
+    if (!(given & LAB_GIVEN_CHUNK)) options.chunk = tuned.chunk;
+    if (!(given & LAB_GIVEN_SCHEDULE) && options.budget == 0 && options.workers == LAB_WORKERS_THREADS)
+        options.schedule = LAB_SCHEDULE_STEAL;
+    printf("tune=%s %s threads=%ld chunk=%ld kernel=%s simd=%s terms/sec=%.6g\n", path, calibrated ? "calibrated" : "loaded",
+        tuned.threads, tuned.chunk, kernels[tuned.kernel].name, simdNames[tuned.simd], tuned.rate);
+}
+
+/**
+ * Removes --options from argv, so positional arguments keep their places
+ */
+void parseOptions(int *argc, char *argv[]) {
+    int positional = 1;
+    int given = 0; // LAB_GIVEN_* settings the tuned config doesn't override
+    for (int i = 1; i < *argc; ++i) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            argv[positional++] = arg;
+        } else if (strcmp(arg, "--scalar") == 0) {
+            options.simd = LAB_SIMD_SCALAR;
+            given |= LAB_GIVEN_SIMD;
+        } else if (strncmp(arg, "--simd=", 7) == 0) {
+            options.simd = parseSimd(arg + 7);
+            given |= LAB_GIVEN_SIMD;
+            if (options.simd < LAB_SIMD_AUTO) {
+                printf("simd must be one of: auto scalar sse2 avx2 avx512\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--kernel=", 9) == 0) {
+            options.kernel = parseKernel(arg + 9);
+            given |= LAB_GIVEN_KERNEL;
+            if (options.kernel < 0) {
+                printf("kernel must be one of: leibniz paired machin chudnovsky\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strcmp(arg, "--affinity=core") == 0) {
+            options.affinity = LAB_AFFINITY_CORE;
+        } else if (strcmp(arg, "--affinity=spread") == 0) {
+            options.affinity = LAB_AFFINITY_SPREAD;
+        } else if (strcmp(arg, "--affinity=none") == 0) {
+            options.affinity = LAB_AFFINITY_NONE;
+        } else if (strcmp(arg, "--schedule=interleaved") == 0) {
+            options.schedule = LAB_SCHEDULE_INTERLEAVED;
+            given |= LAB_GIVEN_SCHEDULE;
+        } else if (strcmp(arg, "--schedule=steal") == 0) {
+            options.schedule = LAB_SCHEDULE_STEAL;
+            given |= LAB_GIVEN_SCHEDULE;
+        } else if (strncmp(arg, "--chunk=", 8) == 0) {
+            options.chunk = strtol(arg + 8, (char**)NULL, 10);
+            given |= LAB_GIVEN_CHUNK;
+            if (options.chunk <= 0) {
+                printf("chunk must be positive\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--cache=", 8) == 0) {
+            options.cache = arg + 8;
+            options.reproducible = 1;
+        } else if (strcmp(arg, "--reduction=reproducible") == 0) {
+            options.reproducible = 1;
+        } else if (strcmp(arg, "--reduction=ordered") == 0) {
+            options.reproducible = 0;
+        } else if (strcmp(arg, "--workers=threads") == 0) {
+            options.workers = LAB_WORKERS_THREADS;
+        } else if (strcmp(arg, "--workers=processes") == 0) {
+            options.workers = LAB_WORKERS_PROCESSES;
+        } else if (strncmp(arg, "--time-budget=", 14) == 0) {
+            options.budget = strtod(arg + 14, (char**)NULL);
+            if (!(options.budget > 0)) {
+                printf("time budget must be a positive number of seconds\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--progress=", 11) == 0) {
+            options.progress = strtod(arg + 11, (char**)NULL);
+            if (!(options.progress > 0)) {
+                printf("progress interval must be a positive number of seconds\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strcmp(arg, "--tune") == 0) {
+            options.tune = LAB_TUNE_LOAD;
+        } else if (strcmp(arg, "--tune=force") == 0) {
+            options.tune = LAB_TUNE_FORCE;
+        } else if (strncmp(arg, "--tune-file=", 12) == 0) {
+            options.tuneFile = arg + 12;
+        } else if (strcmp(arg, "--perf") == 0) {
+            options.perf = 1;
+        } else if (strcmp(arg, "--stats") == 0) {
+            options.stats = 1;
+        } else if (strncmp(arg, "--digits=", 9) == 0) {
+            options.digits = (int)strtol(arg + 9, (char**)NULL, 10);
+            if (options.digits <= 0) {
+                printf("digits must be positive\n");
+                exit(LAB_BAD_ARGS);
+            }
+            options.target = 0.5 * pow(10, 1 - options.digits);
+        } else if (strncmp(arg, "--error=", 8) == 0) {
+            options.target = strtod(arg + 8, (char**)NULL);
+            if (!(options.target > 0)) {
+                printf("error must be positive\n");
+                exit(LAB_BAD_ARGS);
+            }
+            options.digits = (int)ceil(1 - log10(2 * options.target));
+        } else if (strncmp(arg, "--correction=", 13) == 0) {
+            options.correction = (int)strtol(arg + 13, (char**)NULL, 10);
+            if (options.correction < 0 || options.correction > LAB_MAX_CORRECTION) {
+                printf("correction must be in [0, %d]\n", LAB_MAX_CORRECTION);
+                exit(LAB_BAD_ARGS);
+            }
+        } else {
+            printf("unknown option: %s\n", arg);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    *argc = positional;
 
-    if (isCorrect(*n, argv[1]) != 1) {
-        printf("threadsNumber may be contains not only digits\n");
+    if (options.cache != NULL && !options.reproducible) {
+        printf("--cache needs --reduction=reproducible\n");
         exit(LAB_BAD_ARGS);
-    } else if (errno) {
-        printError(errno, pthread_self(), "can't read number of threads");
+    }
+    if (options.workers == LAB_WORKERS_PROCESSES && (options.budget > 0 || options.target > 0 || isBigKernel(options.kernel)
+            || options.schedule == LAB_SCHEDULE_STEAL)) {
+        printf("--workers=processes can't be combined with --time-budget, --digits, --error, --schedule=steal or bignum kernels\n");
         exit(LAB_BAD_ARGS);
-    } else if (*n <= 0) {
-        printf("threadsNumber must be positive\n");
+    }
+    if (options.budget > 0 && (options.target > 0 || options.reproducible || options.schedule == LAB_SCHEDULE_STEAL)) {
+        printf("--time-budget can't be combined with --digits, --error, --reduction=reproducible or --schedule=steal\n");
+        exit(LAB_BAD_ARGS);
+    }
+    if (options.target > 0 && (options.reproducible || options.cache != NULL || options.schedule == LAB_SCHEDULE_STEAL)) {
+        printf("--digits and --error can't be combined with --reduction=reproducible, --cache or --schedule=steal\n");
+        exit(LAB_BAD_ARGS);
+    }
+
+    applyTune(given);
+
+    if (options.simd == LAB_SIMD_AUTO) {
+        options.simd = detectSimd();
+    } else if (!isSimdSupported(options.simd)) {
+        printf("%s is not supported by this cpu\n", simdNames[options.simd]);
+        exit(LAB_BAD_ARGS);
+    }
+}
+
+void initAndMayBeDie(int argc, char *argv[], long *n, long *iterations) { //simplify next 
+    parseOptions(&argc, argv);
+    if (argc < 2) {
+        printf("args: threadsNumber|auto [ iterationsNumber ] [ --kernel=leibniz|paired|machin|chudnovsky ] [ --scalar | --simd=auto|scalar|sse2|avx2|avx512 ]\n"
+               "      [ --affinity=none|core|spread ] [ --schedule=interleaved|steal ] [ --chunk=indexes ] [ --stats ] [ --perf ] [ --progress=seconds ]\n"
+               "      [ --reduction=ordered|reproducible [ --cache=path ] ] [ --time-budget=seconds ]\n"
+               "      [ --tune[=force] [ --tune-file=path ] ]\n"
+               "      [ --workers=threads|processes ]\n"
+               "      [ --digits=D | --error=E [ --correction=0..%d, picked for the target by default ] ], pi is printed rounded to D significant digits\n",
+               LAB_MAX_CORRECTION);
         exit(LAB_BAD_ARGS);
     }
+    if (strcmp(argv[1], "auto") == 0) {
+        *n = tunedThreads > 0 ? tunedThreads : availableCpus();
+    } else {
+        errno = 0;
+        *n = strtol(argv[1], (char **)NULL, 10);
+        if (isCorrect(*n, argv[1]) != 1) {
+            printf("threadsNumber may be contains not only digits\n");
+            exit(LAB_BAD_ARGS);
+        } else if (errno) {
+            printError(errno, pthread_self(), "can't read number of threads");
+            exit(LAB_BAD_ARGS);
+        } else if (*n <= 0) {
+            printf("threadsNumber must be positive\n");
+            exit(LAB_BAD_ARGS);
+        }
+    }
 
     if (argc < 3) {
         *iterations = LAB_ITERATION_NUMBER;
         return;
     }
+    errno = 0;
     *iterations = strtol(argv[2], (char**)NULL, 10);
     if (isCorrect(*iterations, argv[2]) != 1) {
         printf("iterationsNumber must contain only digits and mustn't start with 0\n");
@@ -172,10 +617,107 @@ void initAndMayBeDie(int argc, char *argv[], long *n, long *iterations) { //simp
     // }
 }
 
-double runMultiThreadCalculations(long n, long iterations) {
-    threadLabNode threads[n];
-    initThreads(threads, n, iterations);
-    
+void printRate(threadLabNode *finishedThreads, long n, double wall, double pi) {
+    double perThread = 0;
+    long terms = 0;
+    double minBusy = wall, maxBusy = 0, idle = 0;
+    for (long i = 0; i < n; ++i) {
+        runState p = finishedThreads[i].state;
+        long threadTerms = p.done * kernels[options.kernel].termsPerIndex;
+        terms += threadTerms;
+        if (p.seconds > 0) perThread += threadTerms / p.seconds;
+        if (p.seconds < minBusy) minBusy = p.seconds;
+        if (p.seconds > maxBusy) maxBusy = p.seconds;
+        idle += wall - p.seconds;
+        if (options.stats)
+            printf("thread %ld: terms=%ld busy=%.6fs idle=%.6fs steals=%ld\n", i, threadTerms, p.seconds, wall - p.seconds, p.steals);
+        if (options.perf) {
+            char label[32];
+            snprintf(label, sizeof(label), "thread %ld", i);
+            printPerf(stdout, label, &finishedThreads[i].perf, threadTerms, "term");
+        }
+    }
+    printf("kernel=%s simd=%s terms=%ld wall=%.6fs terms/sec=%.6g per thread=%.6g error=%.6g\n",
+        kernels[options.kernel].name, simdNames[options.simd], terms, wall, terms / wall, perThread / n, fabs(pi - M_PI));
+    printf("schedule=%s busy min=%.6fs max=%.6fs idle=%.2f%%\n",
+        options.schedule == LAB_SCHEDULE_STEAL ? "steal" : "interleaved", minBusy, maxBusy, 100.0 * idle / (wall * n));
+}
+
+static long reruns;
+
+pid_t forkWorker(threadLabNode *node) {
+    node->launched = labNow();
+    pid_t pid = fork();
+    if (pid == 0) {
+        run(node);
+        _exit(LAB_NO_ERROR);
+    }
+    return pid;
+}
+
+/*
+ * Workers are forked processes that write their state into the shared node array.
+ * A worker that dies before it is done is forked again on the same range,
+ * its partial progress is dropped.
+ */
+void runProcessesAndWait(threadLabNode *threads, long n) {
+    pid_t *pids = malloc(sizeof(pid_t) * n);
+    int *tries = calloc(n, sizeof(int));
+    if (pids == NULL || tries == NULL) {
+        printError(ENOMEM, pthread_self(), "can't allocate worker table");
+        exit(LAB_BAD_ALLOC);
+    }
+    for (long i = 0; i < n; ++i) {
+        pids[i] = forkWorker(&threads[i]);
+        if (pids[i] < 0) {
+            printError(errno, pthread_self(), "worker process creation problem, calling exit");
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+    }
+
+    for (long running = n; running > 0;) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0 && errno == EINTR)
+            continue;
+        if (pid < 0) {
+            printError(errno, pthread_self(), "couldn't wait for worker processes");
+            exit(LAB_CANT_WAIT_FOR_THREADS);
+        }
+        long i = 0;
+        while (i < n && pids[i] != pid) ++i;
+        if (i == n)
+            continue;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == LAB_NO_ERROR) {
+            running--;
+            continue;
+        }
+
+        fprintf(stderr, "worker %ld died (%s), running its range again\n", i,
+            WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "exit status");
+        if (++tries[i] > LAB_MAX_RERUNS) {
+            fprintf(stderr, "worker %ld failed %d times, calling exit\n", i, tries[i]);
+            exit(LAB_CANT_WAIT_FOR_THREADS);
+        }
+        memset(&threads[i].state, 0, sizeof(runState));
+        memset(&threads[i].progress, 0, sizeof(seqSlot));
+        reruns++;
+        pids[i] = forkWorker(&threads[i]);
+        if (pids[i] < 0) {
+            printError(errno, pthread_self(), "worker process creation problem, calling exit");
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+    }
+    free(pids);
+    free(tries);
+}
+
+void runAndWait(threadLabNode *threads, long n) {
+    if (options.workers == LAB_WORKERS_PROCESSES) {
+        runProcessesAndWait(threads, n);
+        return;
+    }
+
     threadLabNode * problem = runThreads(threads, n);
     if (problem != NULL) {
         printError(problem->status, problem->thread, "thread creation problem, calling exit");
@@ -187,17 +729,284 @@ double runMultiThreadCalculations(long n, long iterations) {
         printError(problem->status, problem->thread, "couldn't wait for this thread due to some error");
         exit(LAB_CANT_WAIT_FOR_THREADS);
     }
+}
+
+static progressReport progress;
+static int progressDone;
+
+/*
+ * Prints a snapshot on SIGUSR1 and every options.progress seconds, if set.
+ * main wakes it with SIGUSR1 once progressDone is set.
+ */
+void * reporter(void * param) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    struct timespec interval = {(time_t)options.progress, (long)((options.progress - floor(options.progress)) * 1e9)};
+    while (1) {
+        int sig = options.progress > 0 ? sigtimedwait(&set, NULL, &interval) : sigwaitinfo(&set, NULL);
+        if (__atomic_load_n(&progressDone, __ATOMIC_ACQUIRE))
+            break;
+        if (sig == SIGUSR1 || errno == EAGAIN)
+            printProgress(&progress, stdout);
+    }
+    return param;
+}
+
+pthread_t startReporter(threadLabNode *threads, long n, double baseTerms, double baseSum) {
+    if (!initProgress(&progress, n, baseTerms, baseSum)) {
+        printError(ENOMEM, pthread_self(), "can't allocate progress report");
+        exit(LAB_BAD_ALLOC);
+    }
+    for (long i = 0; i < n; ++i) progress.slots[i] = &threads[i].progress;
+
+    pthread_t thread;
+    int code = pthread_create(&thread, NULL, reporter, NULL);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't start progress thread");
+        exit(LAB_CANT_CREATE_THREADS);
+    }
+    return thread;
+}
+
+void stopReporter(pthread_t thread) {
+    __atomic_store_n(&progressDone, 1, __ATOMIC_RELEASE);
+    pthread_kill(thread, SIGUSR1);
+    pthread_join(thread, NULL);
+    freeProgress(&progress);
+}
+
+/*
+ * Memory the workers write their results into, shared with the parent
+ * when the workers are processes
+ */
+void *allocWorkerMemory(size_t size) {
+    if (options.workers == LAB_WORKERS_PROCESSES) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p;
+    }
+    return aligned_alloc(LAB_CACHE_LINE, (size + LAB_CACHE_LINE - 1) / LAB_CACHE_LINE * LAB_CACHE_LINE);
+}
+
+void freeWorkerMemory(void *p, size_t size) {
+    if (p == NULL) return;
+    if (options.workers == LAB_WORKERS_PROCESSES) munmap(p, size);
+    else free(p);
+}
+
+threadLabNode *allocThreads(long n) {
+    threadLabNode *threads = allocWorkerMemory(sizeof(threadLabNode) * n);
+    if (threads == NULL) {
+        printError(ENOMEM, pthread_self(), "threads number is too big");
+        exit(LAB_BAD_ALLOC);
+    }
+    return threads;
+}
+
+void printWorkers(threadLabNode *finishedThreads, long n) {
+    double sum = 0, max = 0;
+    for (long i = 0; i < n; ++i) {
+        double startup = finishedThreads[i].state.started - finishedThreads[i].launched;
+        sum += startup;
+        max = fmax(max, startup);
+    }
+    printf("workers=%s startup avg=%.1fus max=%.1fus reruns=%ld\n",
+        options.workers == LAB_WORKERS_PROCESSES ? "processes" : "threads", sum / n * 1e6, max * 1e6, reruns);
+}
+
+double runMultiThreadCalculations(long n, long iterations) {
+    double begin = labNow();
+    threadLabNode *threads = allocThreads(n);
+    long total = n * indexesPerThread(iterations);
+
+    double *blocks = NULL;
+    long blockCount = (total + LAB_REDUCTION_BLOCK - 1) / LAB_REDUCTION_BLOCK;
+    if (options.reproducible) {
+        blocks = allocWorkerMemory(sizeof(double) * blockCount);
+        if (blocks == NULL) {
+            printError(ENOMEM, pthread_self(), "can't allocate reduction blocks");
+            exit(LAB_BAD_ALLOC);
+        }
+    }
+
+    // full blocks below the cached count are taken from the cache, only the rest is summed
+    sumCache cache;
+    long reused = 0;
+    double reusedSum = 0;
+    if (options.cache != NULL) {
+        int code = openSumCache(&cache, options.cache, options.kernel, options.simd, LAB_REDUCTION_BLOCK);
+        if (code != LAB_NO_ERROR) {
+            printError(code, pthread_self(), "can't open partial sum cache");
+            exit(LAB_CANT_CACHE);
+        }
+        reused = cache.header->blocks < total / LAB_REDUCTION_BLOCK ? cache.header->blocks : total / LAB_REDUCTION_BLOCK;
+        memcpy(blocks, cachedSums(&cache), sizeof(double) * reused);
+        for (long b = 0; b < reused; ++b) reusedSum += blocks[b];
+    }
+
+    stealScheduler *scheduler = NULL;
+    if (options.schedule == LAB_SCHEDULE_STEAL) {
+        // chunks must match blocks for a reproducible reduction
+        scheduler = createScheduler(n, reused, total, options.reproducible ? LAB_REDUCTION_BLOCK : options.chunk);
+        if (scheduler == NULL) {
+            printError(ENOMEM, pthread_self(), "can't allocate work deques");
+            exit(LAB_BAD_ALLOC);
+        }
+    }
+    initThreads(threads, n, total, scheduler, LAB_ACC_DOUBLE, blocks, reused);
+    pthread_t reporterThread = startReporter(threads, n, (double)reused * LAB_REDUCTION_BLOCK * kernels[options.kernel].termsPerIndex, reusedSum);
+    runAndWait(threads, n);
+    stopReporter(reporterThread);
+
+    double pi;
+    if (options.reproducible) {
+        double reduceBegin = labNow();
+        pi = 4.0 * pairwiseSum(blocks, blockCount);
+        double reduce = labNow() - reduceBegin;
+        printRate(threads, n, labNow() - begin, pi);
+        printf("reduction=reproducible blocks=%ld block=%d reduce=%.6fs\n", blockCount, LAB_REDUCTION_BLOCK, reduce);
+    } else {
+        pi = 4.0 * collectResults(threads, n);
+        printRate(threads, n, labNow() - begin, pi);
+    }
+    if (options.cache != NULL) {
+        int code = extendSumCache(&cache, blocks, total / LAB_REDUCTION_BLOCK);
+        if (code != LAB_NO_ERROR) printError(code, pthread_self(), "can't extend partial sum cache");
+        printf("cache=%s reused blocks=%ld computed blocks=%ld cached blocks=%ld\n",
+            cache.path, reused, blockCount - reused, cache.header->blocks);
+        closeSumCache(&cache);
+    }
+    printWorkers(threads, n);
+    destroyScheduler(scheduler);
+    freeWorkerMemory(blocks, sizeof(double) * blockCount);
+    freeWorkerMemory(threads, sizeof(threadLabNode) * n);
+    return pi;
+}
+
+/*
+ * Runs every worker until the deadline, the iteration count is ignored
+ */
+double runBudgetCalculations(long n) {
+    double begin = labNow();
+    deadline = begin + options.budget;
+    threadLabNode *threads = allocThreads(n);
+    initThreads(threads, n, 0, NULL, LAB_ACC_DOUBLE, NULL, 0);
+    pthread_t reporterThread = startReporter(threads, n, 0, 0);
+    runAndWait(threads, n);
+    double end = labNow();
+    stopReporter(reporterThread);
 
     double pi = 4.0 * collectResults(threads, n);
+    printRate(threads, n, end - begin, pi);
+    // sustained rate leaves out thread start and join
+    double busy = 0;
+    for (long i = 0; i < n; ++i) busy = fmax(busy, threads[i].state.seconds);
+    printf("budget=%.3fs overshoot=%.3fms sustained terms/sec=%.6g per thread terms=", options.budget, (end - deadline) * 1000,
+        claimedBlocks * (double)LAB_BUDGET_BLOCK * kernels[options.kernel].termsPerIndex / busy);
+    for (long i = 0; i < n; ++i)
+        printf(i == 0 ? "%ld" : " %ld", threads[i].state.done * kernels[options.kernel].termsPerIndex);
+    printf("\n");
+    freeWorkerMemory(threads, sizeof(threadLabNode) * n);
     return pi;
 }
 
+/*
+ * Least number of terms whose tail estimate with K correction terms is within half of the target
+ */
+double targetTerms(int K, double target) {
+    double N = K == 0 ? ceil((8 / target - 1) / 2)
+                      : ceil(pow(4 * fabs(eulerNumbers[K]) / (pow(4, K) * target), 1.0 / (2 * K + 1)));
+    return N < 2 * K + 2 ? 2 * K + 2 : N;
+}
+
+/*
+ * Picks the number of terms for the target and, with LAB_CORRECTION_AUTO, the
+ * correction count that needs the fewest series and correction terms together,
+ * then the narrowest accumulator whose rounding bound is within the other half.
+ * Returns the accumulator or -1 if the target can't be reached.
+ */
+int planTarget(double target, long n, long *terms) {
+    int K = options.correction;
+    if (K == LAB_CORRECTION_AUTO) {
+        K = 0;
+        for (int k = 1; k <= LAB_MAX_CORRECTION; ++k)
+            if (targetTerms(k, target) + k < targetTerms(K, target) + K) K = k;
+        options.correction = K;
+    }
+    double N = targetTerms(K, target);
+    if (N > LONG_MAX / 4) return -1;
+
+    int step = kernels[options.kernel].termsPerIndex;
+    *terms = ((long)N + step - 1) / step * step;
+    for (int acc = LAB_ACC_DOUBLE; acc <= LAB_ACC_WIDE; ++acc)
+        if (leibnizRoundingBound(*terms, n, acc) <= target / 2) return acc;
+    return -1;
+}
+
+/*
+ * Sums just enough terms for options.target and adds the tail expansion
+ */
+void runTargetCalculations(long n) {
+    long terms;
+    int acc = planTarget(options.target, n, &terms);
+    if (acc < 0) {
+        printf("error %.3g can't be reached with %s accumulator and correction=%d\n",
+            options.target, LAB_WIDE_NAME, options.correction);
+        exit(LAB_BAD_ARGS);
+    }
+
+    double begin = labNow();
+    threadLabNode *threads = allocThreads(n);
+    initThreads(threads, n, terms / kernels[options.kernel].termsPerIndex, NULL, acc, NULL, 0);
+    runAndWait(threads, n);
+
+    labWide pi = 4 * collectWideResults(threads, n) + leibnizTail(terms, options.correction);
+    double wall = labNow() - begin;
+    labWide error = pi > LAB_PI_WIDE ? pi - LAB_PI_WIDE : LAB_PI_WIDE - pi;
+    printf("kernel=%s target=%.3g correction=%d terms=%ld accumulator=%s wall=%.6fs estimate=%.3g error=%.3g\n",
+        kernels[options.kernel].name, options.target, options.correction, terms, accNames[acc], wall,
+        leibnizTailBound(terms, options.correction) + leibnizRoundingBound(terms, n, acc), (double)error);
+    printf("pi=");
+    printWide(stdout, pi, options.digits);
+    freeWorkerMemory(threads, sizeof(threadLabNode) * n);
+}
+
+/*
+ * Bignum kernels take --digits, LAB_BIG_DIGITS by default, and ignore the iteration count
+ */
+void runBigCalculations(long n) {
+    long digits = options.digits > 0 ? options.digits : LAB_BIG_DIGITS;
+    double begin = labNow();
+    char *pi = kernels[options.kernel].bigPi(n, digits);
+    if (pi == NULL) {
+        printError(EAGAIN, pthread_self(), "thread creation problem, calling exit");
+        exit(LAB_CANT_CREATE_THREADS);
+    }
+    printf("kernel=%s digits=%ld threads=%ld wall=%.6fs\n", kernels[options.kernel].name, digits, n, labNow() - begin);
+    printf("pi=%s\n", pi);
+    free(pi);
+}
+
 int main(int argc, char *argv[]) {
+    // taken by the progress reporter only, every other thread inherits the mask
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
     long n;
     long iterations;
     initAndMayBeDie(argc, argv, &n, &iterations);
+    if (isBigKernel(options.kernel)) {
+        runBigCalculations(n);
+        exit(LAB_NO_ERROR);
+    }
+    if (options.target > 0) {
+        runTargetCalculations(n);
+        exit(LAB_NO_ERROR);
+    }
     
-    double pi = runMultiThreadCalculations(n, iterations);    
+    double pi = options.budget > 0 ? runBudgetCalculations(n) : runMultiThreadCalculations(n, iterations);    
     printf("pi=%.30g\n", pi);
 
     exit(LAB_NO_ERROR);
@@ -0,0 +1,517 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "labpi.h"
+#include "labcpu.h"
+#include "labpool.h"
+#include "labnet.h"
+
+/*
+ * Sums the series across processes: the coordinator splits the indexes
+ * into ranges and hands batches of them to any number of workers over
+ * a unix or tcp socket (see labnet.h), ranges held by a worker that
+ * disconnects or stops sending heartbeats are handed to the others.
+ */
+
+#define LAB_NO_ERROR 0
+#define LAB_SOME_ERROR 1
+
+#define LAB_CANT_CREATE_THREADS 2
+#define LAB_BAD_ARGS 5
+#define LAB_BAD_ALLOC 6
+#define LAB_CANT_CONNECT 7
+
+#define LAB_ITERATION_NUMBER 100000000
+#define LAB_NET_RANGE (1L << 22) // indexes in one range
+#define LAB_HEARTBEAT_INTERVAL 100 // ms
+
+#define LAB_RANGE_FREE -1
+#define LAB_RANGE_DONE -2
+
+typedef struct _labOptions {
+    int simd;
+    int kernel;
+    long range;
+    long batch;      // ranges per assignment, 0 for the worker's threads
+    long heartbeat;  // ms
+} labOptions;
+
+static labOptions options = {LAB_SIMD_AUTO, LAB_KERNEL_LEIBNIZ, LAB_NET_RANGE, 0, LAB_HEARTBEAT_INTERVAL};
+
+void printError(int code, pthread_t thread, char * what) {
+    fprintf(stderr, "Error with thr %lu\n%s; %s\n", thread, what, strerror(code));
+}
+
+int isCorrect(long number, char *str) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", number);
+    return strcmp(buf, str) == 0;
+}
+
+long parsePositiveOrDie(const char *what, char *str) {
+    errno = 0;
+    long value = strtol(str, (char **)NULL, 10);
+    if (errno || isCorrect(value, str) != 1 || value <= 0) {
+        printf("%s must be a positive number\n", what);
+        exit(LAB_BAD_ARGS);
+    }
+    return value;
+}
+
+void parseOptions(int *argc, char *argv[]) {
+    int positional = 1;
+    for (int i = 1; i < *argc; ++i) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            argv[positional++] = arg;
+        } else if (strcmp(arg, "--scalar") == 0) {
+            options.simd = LAB_SIMD_SCALAR;
+        } else if (strncmp(arg, "--simd=", 7) == 0) {
+            options.simd = parseSimd(arg + 7);
+            if (options.simd < LAB_SIMD_AUTO) {
+                printf("simd must be one of: auto scalar sse2 avx2 avx512\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--kernel=", 9) == 0) {
+            options.kernel = parseKernel(arg + 9);
+            if (options.kernel < 0 || isBigKernel(options.kernel)) {
+                printf("kernel must be one of: leibniz paired\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--range=", 8) == 0) {
+            options.range = parsePositiveOrDie("range", arg + 8);
+        } else if (strncmp(arg, "--batch=", 8) == 0) {
+            options.batch = parsePositiveOrDie("batch", arg + 8);
+            if (options.batch > LAB_NET_MAX_BATCH / 2) {
+                printf("batch must be at most %d\n", LAB_NET_MAX_BATCH / 2);
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--heartbeat=", 12) == 0) {
+            options.heartbeat = parsePositiveOrDie("heartbeat", arg + 12);
+            if (options.heartbeat > 60000) {
+                printf("heartbeat must be at most 60000 ms\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else {
+            printf("unknown option %s\n", arg);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    *argc = positional;
+}
+
+int openOrDie(const char *address, int listening) {
+    int fd = netOpen(address, listening);
+    if (fd < 0) {
+        printError(-fd, pthread_self(), listening ? "can't listen on address" : "can't connect to coordinator");
+        exit(LAB_CANT_CONNECT);
+    }
+    return fd;
+}
+
+/*
+ * Coordinator: ranges are taken from the reassigned stack first, then in order,
+ * every worker keeps at most two batches in flight so it never waits for work
+ */
+typedef struct _netWorker {
+    int fd;
+    long threads;
+    long inflight; // ranges assigned and not returned
+    long done;
+    double lastSeen;
+} netWorker;
+
+static netWorker *workers;
+static long workerCount;
+static long deadWorkers;
+
+static long indexes;
+static long ranges;
+static long nextFresh;
+static long *owner;    // worker index, LAB_RANGE_FREE or LAB_RANGE_DONE
+static double *sums;
+static long *pending;  // ranges of dead workers
+static long pendingCount;
+static long doneCount;
+static long reassigned;
+
+long takeRange() {
+    if (pendingCount > 0) return pending[--pendingCount];
+    if (nextFresh < ranges) return nextFresh++;
+    return -1;
+}
+
+void dropWorker(long w) {
+    netWorker *worker = &workers[w];
+    close(worker->fd);
+    worker->fd = -1;
+    deadWorkers++;
+    for (long r = 0; r < ranges && worker->inflight > 0; ++r) {
+        if (owner[r] != w) continue;
+        owner[r] = LAB_RANGE_FREE;
+        pending[pendingCount++] = r;
+        worker->inflight--;
+        reassigned++;
+    }
+    worker->inflight = 0;
+}
+
+long batchOf(netWorker *worker) {
+    long batch = options.batch ? options.batch : worker->threads;
+    return batch < LAB_NET_MAX_BATCH / 2 ? batch : LAB_NET_MAX_BATCH / 2;
+}
+
+void assignWork(long w) {
+    netWorker *worker = &workers[w];
+    long batch = batchOf(worker);
+    netRange assign[LAB_NET_MAX_BATCH / 2];
+    while (worker->fd >= 0 && worker->inflight + batch <= 2 * batch) {
+        uint32_t count = 0;
+        long r;
+        while (count < batch && (r = takeRange()) >= 0) {
+            long first = r * options.range;
+            assign[count].first = first;
+            assign[count].count = first + options.range < indexes ? options.range : indexes - first;
+            owner[r] = w;
+            count++;
+        }
+        if (count == 0) return;
+        worker->inflight += count;
+        if (netSend(worker->fd, LAB_NET_ASSIGN, options.kernel, count, assign) != 0) {
+            dropWorker(w);
+            return;
+        }
+    }
+}
+
+void acceptWorker(int listener) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) return;
+
+    // a worker stopped in the middle of a message must not stall the coordinator
+    struct timeval timeout = {0, 0};
+    long ms = options.heartbeat * LAB_NET_MISSED_HEARTBEATS;
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_usec = ms % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    netHeader h;
+    if (netRecvHeader(fd, &h) != 0 || h.type != LAB_NET_HELLO || h.count == 0
+            || netSend(fd, LAB_NET_HELLO, options.kernel, options.heartbeat, NULL) != 0) {
+        close(fd);
+        return;
+    }
+    netWorker *grown = realloc(workers, sizeof(netWorker) * (workerCount + 1));
+    if (grown == NULL) {
+        printError(ENOMEM, pthread_self(), "can't allocate worker table, worker refused");
+        close(fd);
+        return;
+    }
+    workers = grown;
+    workers[workerCount] = (netWorker){fd, h.count, 0, 0, labNow()};
+    workerCount++;
+}
+
+void readWorker(long w) {
+    netWorker *worker = &workers[w];
+    netHeader h;
+    netRange results[LAB_NET_MAX_BATCH];
+    if (netRecvHeader(worker->fd, &h) != 0 || (h.type != LAB_NET_HEARTBEAT && h.type != LAB_NET_RESULT)
+            || netRecvRanges(worker->fd, &h, results) != 0) {
+        dropWorker(w);
+        return;
+    }
+    worker->lastSeen = labNow();
+    for (uint32_t i = 0; h.type == LAB_NET_RESULT && i < h.count; ++i) {
+        long r = results[i].first / options.range;
+        if (results[i].first % options.range != 0 || r >= ranges || owner[r] != w) continue;
+        owner[r] = LAB_RANGE_DONE;
+        sums[r] = results[i].sum;
+        worker->inflight--;
+        worker->done++;
+        doneCount++;
+    }
+}
+
+void allocRangesOrDie(long iterations) {
+    int step = kernels[options.kernel].termsPerIndex;
+    indexes = (iterations + step - 1) / step;
+    ranges = (indexes + options.range - 1) / options.range;
+    owner = malloc(sizeof(long) * ranges);
+    sums = malloc(sizeof(double) * ranges);
+    pending = malloc(sizeof(long) * ranges);
+    if (owner == NULL || sums == NULL || pending == NULL) {
+        printError(ENOMEM, pthread_self(), "can't allocate range table");
+        exit(LAB_BAD_ALLOC);
+    }
+    for (long r = 0; r < ranges; ++r) owner[r] = LAB_RANGE_FREE;
+}
+
+void runCoordinator(const char *address, long iterations) {
+    allocRangesOrDie(iterations);
+    int listener = openOrDie(address, 1);
+    double begin = labNow();
+    struct pollfd *fds = NULL;
+
+    while (doneCount < ranges) {
+        struct pollfd *grown = realloc(fds, sizeof(struct pollfd) * (workerCount + 1));
+        if (grown == NULL) {
+            printError(ENOMEM, pthread_self(), "can't allocate poll table");
+            exit(LAB_BAD_ALLOC);
+        }
+        fds = grown;
+        fds[0] = (struct pollfd){listener, POLLIN, 0};
+        for (long w = 0; w < workerCount; ++w) fds[w + 1] = (struct pollfd){workers[w].fd, POLLIN, 0};
+
+        if (poll(fds, workerCount + 1, options.heartbeat) < 0 && errno != EINTR) {
+            printError(errno, pthread_self(), "can't wait for workers");
+            exit(LAB_SOME_ERROR);
+        }
+        double now = labNow();
+        long polled = workerCount;
+        for (long w = 0; w < polled; ++w) {
+            if (workers[w].fd < 0) continue;
+            if (fds[w + 1].revents) readWorker(w);
+            else if (now - workers[w].lastSeen > options.heartbeat * LAB_NET_MISSED_HEARTBEATS / 1000.0) dropWorker(w);
+        }
+        if (fds[0].revents & POLLIN) acceptWorker(listener);
+        for (long w = 0; w < workerCount; ++w) assignWork(w);
+    }
+    double wall = labNow() - begin;
+
+    for (long w = 0; w < workerCount; ++w) {
+        if (workers[w].fd < 0) continue;
+        netSend(workers[w].fd, LAB_NET_DONE, options.kernel, 0, NULL);
+        close(workers[w].fd);
+    }
+    close(listener);
+    if (strncmp(address, "unix:", 5) == 0) unlink(address + 5);
+
+    double sum = 0;
+    for (long r = 0; r < ranges; ++r) sum += sums[r];
+    double pi = 4 * sum;
+    double terms = (double)indexes * kernels[options.kernel].termsPerIndex;
+    printf("kernel=%s workers=%ld dead=%ld ranges=%ld reassigned=%ld terms=%.0f wall=%.3fs terms/sec=%.6g error=%.3g\n",
+        kernels[options.kernel].name, workerCount, deadWorkers, ranges, reassigned, terms, wall, terms / wall, fabs(pi - M_PI));
+    printf("per worker ranges=");
+    for (long w = 0; w < workerCount; ++w) printf(w == 0 ? "%ld" : " %ld", workers[w].done);
+    printf("\n");
+    printf("pi=%.30g\n", pi);
+
+    free(fds);
+    free(workers);
+    free(owner);
+    free(sums);
+    free(pending);
+}
+
+/*
+ * Worker: the main thread reads assignments and queues their ranges on the pool,
+ * a sender thread returns the results of each batch in order and a heartbeat
+ * thread keeps the coordinator from reassigning ranges that take long
+ */
+typedef struct _workerBatch workerBatch;
+struct _workerBatch {
+    uint32_t count;
+    netRange *ranges;
+    piJob *jobs;
+    workerBatch *next;
+};
+
+typedef struct _workerState {
+    int fd;
+    long heartbeat; // ms
+    piPool pool;
+    pthread_mutex_t sendLock;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    workerBatch *head;
+    workerBatch *tail;
+    int finished;   // no more batches will be queued
+    int failed;     // a send failed, the coordinator is gone
+    long done;
+    double terms;
+} workerState;
+
+void *sender(void *param) {
+    workerState *s = (workerState *)param;
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        while (s->head == NULL && !s->finished)
+            pthread_cond_wait(&s->changed, &s->lock);
+        workerBatch *b = s->head;
+        if (b == NULL) break;
+        s->head = b->next;
+        if (s->head == NULL) s->tail = NULL;
+        pthread_mutex_unlock(&s->lock);
+
+        for (uint32_t i = 0; i < b->count; ++i)
+            b->ranges[i].sum = piPoolWait(&s->pool, &b->jobs[i]) / 4; // exact, 4 is a power of two
+        pthread_mutex_lock(&s->sendLock);
+        int code = netSend(s->fd, LAB_NET_RESULT, 0, b->count, b->ranges);
+        pthread_mutex_unlock(&s->sendLock);
+
+        pthread_mutex_lock(&s->lock);
+        if (code != 0) s->failed = 1;
+        s->done += b->count;
+        for (uint32_t i = 0; i < b->count; ++i) s->terms += b->jobs[i].terms;
+        free(b->ranges);
+        free(b->jobs);
+        free(b);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return param;
+}
+
+void *heartbeater(void *param) {
+    workerState *s = (workerState *)param;
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    pthread_mutex_lock(&s->lock);
+    while (!s->finished && !s->failed) {
+        until.tv_nsec += s->heartbeat % 1000 * 1000000;
+        until.tv_sec += s->heartbeat / 1000 + until.tv_nsec / 1000000000;
+        until.tv_nsec %= 1000000000;
+        while (!s->finished && pthread_cond_timedwait(&s->changed, &s->lock, &until) != ETIMEDOUT);
+        if (s->finished) break;
+        pthread_mutex_unlock(&s->lock);
+
+        pthread_mutex_lock(&s->sendLock);
+        int code = netSend(s->fd, LAB_NET_HEARTBEAT, 0, 0, NULL);
+        pthread_mutex_unlock(&s->sendLock);
+
+        pthread_mutex_lock(&s->lock);
+        if (code != 0) s->failed = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return param;
+}
+
+/*
+ * Queues the ranges of an assignment on the pool and hands them to the sender
+ */
+int queueBatch(workerState *s, const netHeader *h, netRange *assign) {
+    workerBatch *b = calloc(1, sizeof(workerBatch));
+    if (b == NULL) return ENOMEM;
+    b->count = h->count;
+    b->ranges = malloc(sizeof(netRange) * h->count);
+    b->jobs = calloc(h->count, sizeof(piJob));
+    if (b->ranges == NULL || b->jobs == NULL) {
+        free(b->ranges);
+        free(b->jobs);
+        free(b);
+        return ENOMEM;
+    }
+    memcpy(b->ranges, assign, sizeof(netRange) * h->count);
+    int step = kernels[h->kernel].termsPerIndex;
+    for (uint32_t i = 0; i < h->count; ++i) {
+        b->jobs[i] = (piJob){.kernel = h->kernel, .terms = (long)assign[i].count * step, .first = (long)assign[i].first};
+        int code = piPoolSubmit(&s->pool, &b->jobs[i]);
+        if (code != 0) return code; // the worker exits, queued jobs are never freed
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (s->tail != NULL) s->tail->next = b;
+    else s->head = b;
+    s->tail = b;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int runWorker(const char *address, long threads) {
+    workerState s;
+    memset(&s, 0, sizeof(s));
+    int code = piPoolInit(&s.pool, threads, options.simd);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't start pi pool");
+        exit(LAB_CANT_CREATE_THREADS);
+    }
+    s.fd = openOrDie(address, 0);
+
+    netHeader h;
+    if ((code = netSend(s.fd, LAB_NET_HELLO, 0, threads, NULL)) != 0 || (code = netRecvHeader(s.fd, &h)) != 0
+            || (code = h.type == LAB_NET_HELLO ? 0 : EPROTO) != 0) {
+        printError(code, pthread_self(), "coordinator refused the worker");
+        exit(LAB_CANT_CONNECT);
+    }
+    s.heartbeat = h.count;
+    pthread_mutex_init(&s.sendLock, NULL);
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s.changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t senderThread, heartbeatThread;
+    if ((code = pthread_create(&senderThread, NULL, sender, &s)) != 0
+            || (code = pthread_create(&heartbeatThread, NULL, heartbeater, &s)) != 0) {
+        printError(code, pthread_self(), "thread creation problem, calling exit");
+        exit(LAB_CANT_CREATE_THREADS);
+    }
+
+    double begin = labNow();
+    netRange assign[LAB_NET_MAX_BATCH];
+    int status = LAB_NO_ERROR;
+    while (1) {
+        code = netRecvHeader(s.fd, &h);
+        if (code == 0 && h.type == LAB_NET_DONE) break;
+        if (code == 0 && (h.type != LAB_NET_ASSIGN || h.kernel >= (int)(sizeof(kernels) / sizeof(kernels[0]))))
+            code = EPROTO;
+        if (code == 0) code = netRecvRanges(s.fd, &h, assign);
+        if (code == 0) code = queueBatch(&s, &h, assign);
+        if (code != 0) {
+            printError(code, pthread_self(), "lost the coordinator");
+            status = LAB_CANT_CONNECT;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&s.lock);
+    s.finished = 1;
+    pthread_cond_broadcast(&s.changed);
+    pthread_mutex_unlock(&s.lock);
+    if (status != LAB_NO_ERROR) exit(status); // the sender may wait for jobs that were never submitted
+    pthread_join(senderThread, NULL);
+    pthread_join(heartbeatThread, NULL);
+    double wall = labNow() - begin;
+
+    printf("worker threads=%ld ranges=%ld terms=%.0f wall=%.3fs terms/sec=%.6g\n",
+        threads, s.done, s.terms, wall, wall > 0 ? s.terms / wall : 0);
+    close(s.fd);
+    piPoolShutdown(&s.pool);
+    pthread_cond_destroy(&s.changed);
+    pthread_mutex_destroy(&s.lock);
+    pthread_mutex_destroy(&s.sendLock);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    parseOptions(&argc, argv);
+    int coordinator = argc >= 3 && strcmp(argv[1], "coordinator") == 0;
+    int worker = argc >= 4 && strcmp(argv[1], "worker") == 0;
+    if (!coordinator && !worker) {
+        printf("args: coordinator unix:path|tcp:[host:]port [ iterationsNumber ] [ --kernel=leibniz|paired ] [ --range=indexes ]\n"
+               "      [ --batch=ranges ] [ --heartbeat=ms ]\n"
+               "      worker unix:path|tcp:[host:]port threadsNumber|auto [ --scalar | --simd=auto|scalar|sse2|avx2|avx512 ]\n");
+        exit(LAB_BAD_ARGS);
+    }
+
+    if (coordinator) {
+        long iterations = argc > 3 ? parsePositiveOrDie("iterationsNumber", argv[3]) : LAB_ITERATION_NUMBER;
+        runCoordinator(argv[2], iterations);
+        exit(LAB_NO_ERROR);
+    }
+    long threads = strcmp(argv[3], "auto") == 0 ? availableCpus() : parsePositiveOrDie("threadsNumber", argv[3]);
+    exit(runWorker(argv[2], threads));
+}
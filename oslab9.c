@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <pthread.h>
@@ -9,6 +10,13 @@
 
 #include <signal.h>
 
+#include "labpi.h"
+#include "labcpu.h"
+#include "labseq.h"
+#include "labcheckpoint.h"
+#include "labtune.h"
+#include "labperf.h"
+
 #define LAB_NO_ERROR 0
 #define LAB_SOME_ERROR 1
 
@@ -17,27 +25,104 @@
 #define LAB_CANT_WAIT_FOR_THREADS 4
 #define LAB_BAD_ARGS 5
 #define LAB_BAD_ALLOC 6
+#define LAB_CANT_CHECKPOINT 7
+
+#define  LAB_RANGE 10000 // terms in a block unless --range or --tune set it
+
+#define LAB_CACHE_LINE 64
+
+#define LAB_CHECKPOINT_INTERVAL 10.0
+
+#define LAB_STOP_LATENCY 5.0
+#define LAB_MAX_CHUNK_BLOCKS 4096
+#define LAB_PREFIX_HISTORY 4096
 
-#define  LAB_RANGE 10000
+#define LAB_SHUTDOWN_PREFIX 0
+#define LAB_SHUTDOWN_IMMEDIATE 1
+
+#define LAB_TUNE_OFF 0
+#define LAB_TUNE_LOAD 1  // load the host config, calibrate if there is none
+#define LAB_TUNE_FORCE 2 // calibrate again
+
+#define LAB_GIVEN_KERNEL 1
+#define LAB_GIVEN_SIMD 2
+#define LAB_GIVEN_RANGE 4
 
 typedef struct _threadRunParams {
+    long index;
     double start;
     double range;
     long totalThreads;
+    leibnizSumFunc sum;
 } runParams;
+/*
+ * Written by the worker only, kept on its own cache line.
+ * progress holds the terms of the worker's own blocks and the whole sum,
+ * it is updated after every block for the checkpoint thread.
+ */
+typedef struct _threadRunState {
+    double result;
+    double terms;
+    double seconds;
+    long maxChunk;
+    double next;        // first own block not summed when stop was noticed
+    double perBlock;
+    double prefix;      // agreed number of blocks
+    double discarded;   // terms summed past the prefix
+    double agreeSeconds;
+    seqSlot progress;
+} __attribute__((aligned(LAB_CACHE_LINE))) runState;
+
 typedef struct _threadLabNode threadLabNode;
 struct _threadLabNode {
     runParams params;
     pthread_t thread;
-    double result; 
     int status;
-};
+    runState state;
+    perfCounters perf; // of the worker, filled when --perf is given
+} __attribute__((aligned(LAB_CACHE_LINE)));
+
+typedef struct _labOptions {
+    int simd;
+    int kernel;
+    char *checkpoint;
+    double checkpointInterval;
+    int resume;
+    double stopLatency; // seconds
+    int shutdown;
+    double progress; // seconds between reports, 0 for SIGUSR1 only
+    double budget; // seconds to run for, 0 to run until a signal
+    long range; // terms in a block
+    int tune; // LAB_TUNE_*
+    char *tuneFile; // NULL for the per-host default
+    int perf; // count cycles, instructions and misses of every worker
+} labOptions;
+
+static labOptions options = {LAB_SIMD_AUTO, LAB_KERNEL_LEIBNIZ, NULL, LAB_CHECKPOINT_INTERVAL, 0, LAB_STOP_LATENCY / 1000, LAB_SHUTDOWN_PREFIX, 0, 0,
+                             LAB_RANGE, LAB_TUNE_OFF, NULL, 0};
+
+/*
+ * Threads used for "auto" when the run is tuned, 0 otherwise
+ */
+static long tunedThreads;
+
+/*
+ * Checkpoint the run resumed from; its unfinished blocks in [resumeFrom, resumeTo)
+ * are summed by the workers before they start on their own blocks from resumeTo
+ */
+static checkpointState resumed;
+static double resumeFrom, resumeTo;
+static long refilledThreads;
+
+static threadLabNode *workers;
+static progressReport progress;
+static long announcedThreads;
 
 threadLabNode constructNode(runParams p) {
     threadLabNode node;
+    memset(&node, 0, sizeof(node));
     node.params = p;
     node.status = LAB_NO_ERROR;
-    node.result = 0;
     return node;    
 }
 
@@ -45,42 +130,137 @@ void printError(int code, pthread_t thread, char * what) {
     fprintf(stderr, "Error with thr %lu\n%s; %s\n", thread, what, strerror(code));
 }
 
-double LeibnizPi(double i) {
-    double f = floor(i);
-    return pow(-1, f) / (2*i + 1.0);
+/*
+ * Set once by the control thread or by main, workers poll it between chunks
+ */
+static int stopRequested = 0;
+static double stopAt;
+static double deadline = INFINITY;
+static pthread_mutex_t stopMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stopCond;
+
+static inline int isRunning() {
+    return !__atomic_load_n(&stopRequested, __ATOMIC_RELAXED);
+}
+
+void requestStop() {
+    pthread_mutex_lock(&stopMutex);
+    if (!stopRequested) {
+        stopAt = labNow();
+        __atomic_store_n(&stopRequested, 1, __ATOMIC_RELEASE);
+    }
+    pthread_cond_broadcast(&stopCond);
+    pthread_mutex_unlock(&stopMutex);
 }
 
-static int doRun = 1;
 /*
- * this function should not be called from anywhere except signal handler
- * since it affects work of different threads
+ * Waits on stopCond until stop is requested or the given CLOCK_MONOTONIC time,
+ * returns 0 once stop is requested
  */
-void sigcatch(int sig) {
-    doRun = 0;
+int waitWhileRunning(double until) {
+    struct timespec ts = {(time_t)until, (long)((until - floor(until)) * 1e9)};
+    pthread_mutex_lock(&stopMutex);
+    while (!stopRequested && pthread_cond_timedwait(&stopCond, &stopMutex, &ts) == 0);
+    int running = !stopRequested;
+    pthread_mutex_unlock(&stopMutex);
+    return running;
 }
 
-void blockSIGINT() {
-    sigset_t new;
-    sigemptyset(&new);
-    sigaddset(&new, SIGINT);
-    pthread_sigmask(SIG_BLOCK, &new, NULL);
+/*
+ * Signals every thread keeps blocked; faults are left alone,
+ * blocking them is undefined
+ */
+void fillControlledSignals(sigset_t *set) {
+    sigfillset(set);
+    sigdelset(set, SIGSEGV);
+    sigdelset(set, SIGBUS);
+    sigdelset(set, SIGFPE);
+    sigdelset(set, SIGILL);
 }
 
-void unblockSIGINT() {
-    sigset_t new;
-    sigemptyset(&new);
-    sigaddset(&new, SIGINT);
-    pthread_sigmask(SIG_UNBLOCK, &new, NULL);
+/*
+ * Has to run before any other thread is created, they inherit the mask,
+ * so SIGINT is never delivered to a worker in the middle of a block
+ */
+void blockSignalsOrDie() {
+    sigset_t set;
+    fillControlledSignals(&set);
+    int code = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    pthread_condattr_t attr;
+    if (code == LAB_NO_ERROR) code = pthread_condattr_init(&attr);
+    if (code == LAB_NO_ERROR) code = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (code == LAB_NO_ERROR) code = pthread_cond_init(&stopCond, &attr);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't set up signal handling");
+        exit(LAB_SOME_ERROR);
+    }
 }
 
-void setSigcatch() {
-    struct sigaction act;
-    act.sa_handler = sigcatch;    
-    //https://illumos.org/man/2/sigaction
-    if (sigaction(SIGINT, &act, NULL) == EINVAL) {
-        printError(EINVAL, pthread_self(), "can't set signal SIGINT for main thread");
-        exit(LAB_SOME_ERROR);
+/*
+ * The only thread that takes signals. SIGINT and SIGTERM stop the run,
+ * SIGUSR1 prints a progress snapshot,
+ * SIGUSR2 is sent by main to release it when the run ends on its own.
+ * With a time budget it also stops the run one stop latency before the deadline,
+ * so the workers are done close to it.
+ */
+void * control(void * param) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    double stopBy = deadline - options.stopLatency;
+    while (1) {
+        int sig;
+        if (isinf(stopBy)) {
+            if (sigwait(&set, &sig) != 0) break;
+        } else {
+            double left = fmax(0.0, stopBy - labNow());
+            struct timespec timeout = {(time_t)left, (long)((left - floor(left)) * 1e9)};
+            sig = sigtimedwait(&set, NULL, &timeout);
+            if (sig < 0 && errno == EINTR) continue;
+            if (sig < 0 && labNow() < stopBy) continue;
+        }
+        if (sig == SIGUSR1) {
+            printProgress(&progress, stdout);
+        } else {
+            requestStop();
+            break;
+        }
+    }
+    return param;
+}
+
+void * reporter(void * param) {
+    while (waitWhileRunning(labNow() + options.progress))
+        printProgress(&progress, stdout);
+    return param;
+}
+
+/*
+ * Every worker posts the first own block it has not summed and its time per block,
+ * then all of them pick the same prefix from the posted values: the furthest one,
+ * lowered until every worker behind can catch up within budget seconds.
+ * All blocks below the nearest posted one are done, so that is the lower limit.
+ */
+double agreePrefix(threadLabNode *tn, double next, double perBlock, double budget) {
+    long n = tn->params.totalThreads;
+    tn->state.next = next;
+    tn->state.perBlock = perBlock;
+    __atomic_add_fetch(&announcedThreads, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&announcedThreads, __ATOMIC_ACQUIRE) < n)
+        sched_yield();
+
+    double nearest = INFINITY, furthest = 0, reach = INFINITY;
+    for (long i = 0; i < n; ++i) {
+        runState *s = &workers[i].state;
+        nearest = fmin(nearest, s->next);
+        furthest = fmax(furthest, s->next);
+        if (s->perBlock > 0)
+            reach = fmin(reach, s->next + n * floor(budget / s->perBlock));
     }
+    return fmax(nearest, fmin(furthest, reach));
 }
 
 void * run(void * param) {
@@ -91,25 +271,90 @@ void * run(void * param) {
     runParams p = tn->params;
 
     double res = 0;
+    double terms = 0;
     long range = (long)p.range;
 #ifdef LAB_DEBUG
     printf("range: %d\n", range);
 #endif
+    double begin = labNow();
+    int termsPerIndex = kernels[options.kernel].termsPerIndex;
+    if (options.perf) perfStart(&tn->perf);
+
+    double first = resumeFrom + fmod(p.index - fmod(resumeFrom, p.totalThreads) + p.totalThreads, p.totalThreads);
+    for (double block = first; block < resumeTo; block += p.totalThreads) {
+        if (!isRunning() && options.shutdown == LAB_SHUTDOWN_IMMEDIATE) {
+            tn->state.result = res;
+            tn->state.terms = terms;
+            tn->state.seconds = labNow() - begin;
+            if (options.perf) perfStop(&tn->perf);
+            return param;
+        }
+        if (checkpointHasBlock(&resumed, block)) continue;
+        res += p.sum(block * p.range / termsPerIndex, 1, range / termsPerIndex);
+        terms += range;
+    }
+    __atomic_add_fetch(&refilledThreads, 1, __ATOMIC_RELEASE);
+
+    double history[LAB_PREFIX_HISTORY]; // res before each of the last own blocks
+    long own = 0;
+    long chunk = 1;
+    double perBlock = 0;
+    double target = options.stopLatency / 2 / fmax(1.0, (double)p.totalThreads / availableCpus());
     do {
-        double x = p.start;
-        double subRes = 0;
-        for (long i = 0; i < range; ++i) {
-            subRes += LeibnizPi(x);
-            x++;
+        double chunkBegin = labNow();
+        for (long c = 0; c < chunk; ++c) {
+            history[own++ % LAB_PREFIX_HISTORY] = res;
+            res += p.sum(p.start / termsPerIndex, 1, range / termsPerIndex);
+            p.start += p.range * p.totalThreads;
         }
-        res += subRes;
-        p.start += p.range * p.totalThreads;
-    } while (doRun);
+        seqPublish(&tn->state.progress, own * p.range, res);
+
+        /*
+         * Blocks per stop check, so a chunk takes about half the latency bound,
+         * divided between the threads that share a cpu
+         */
+        perBlock = (labNow() - chunkBegin) / chunk;
+        long next = perBlock > 0 ? (long)fmin(target / perBlock, LAB_MAX_CHUNK_BLOCKS) : 2 * chunk;
+        chunk = next < 1 ? 1 : next > 2 * chunk ? 2 * chunk : next;
+        if (chunk > tn->state.maxChunk) tn->state.maxChunk = chunk;
+    } while (isRunning());
+
+    if (options.shutdown == LAB_SHUTDOWN_PREFIX) {
+        double stopped = labNow();
+        double firstOwn = p.start / p.range - (double)own * p.totalThreads;
+        double prefix = agreePrefix(tn, p.start / p.range, perBlock, target);
+
+        // behind: sum own blocks up to the prefix
+        while (p.start / p.range < prefix) {
+            history[own++ % LAB_PREFIX_HISTORY] = res;
+            res += p.sum(p.start / termsPerIndex, 1, range / termsPerIndex);
+            p.start += p.range * p.totalThreads;
+        }
+
+        // ahead: drop own blocks past it, from history while it reaches back far enough
+        long keep = prefix > firstOwn ? (long)ceil((prefix - firstOwn) / p.totalThreads) : 0;
+        if (keep < own) {
+            tn->state.discarded = (double)(own - keep) * p.range;
+            if (own - keep <= LAB_PREFIX_HISTORY) {
+                res = history[keep % LAB_PREFIX_HISTORY];
+            } else {
+                for (long k = own - 1; k >= keep; --k)
+                    res -= p.sum((firstOwn + (double)k * p.totalThreads) * p.range / termsPerIndex, 1, range / termsPerIndex);
+            }
+            own = keep;
+        }
+        seqPublish(&tn->state.progress, own * p.range, res);
+        tn->state.prefix = prefix;
+        tn->state.agreeSeconds = labNow() - stopped;
+    }
 #ifdef LAB_DEBUG
     double numberOfIterations = p.start;
     printf("%d %.15g %.15g\n", pthread_self(), numberOfIterations,4 * res);
 #endif
-    tn->result = res;
+    tn->state.result = res;
+    tn->state.terms = terms + own * p.range;
+    tn->state.seconds = labNow() - begin;
+    if (options.perf) perfStop(&tn->perf);
     return param;
 }
 
@@ -148,23 +393,203 @@ threadLabNode* waitUntilAllThreadsFinish(threadLabNode *runningJoinableThreads,
 
 double collectResults(threadLabNode *finishedThreads, long n) {
     double res = 0;
-    for (long i = 0; i < n; ++i) res += finishedThreads[i].result;
+    for (long i = 0; i < n; ++i) res += finishedThreads[i].state.result;
     return res;
 }
 
-void initThreads(threadLabNode *threads, long n, double range) {
+typedef struct _checkpointJob {
+    threadLabNode *threads;
+    long n;
+    checkpointFile file;
+    long writes;
+    double seconds;
+} checkpointJob;
+
+/*
+ * Nothing is written until every worker has summed its part of the resumed
+ * checkpoint, since blocks below the new base are taken as done
+ */
+int writeCheckpoint(checkpointJob *job) {
+    if (__atomic_load_n(&refilledThreads, __ATOMIC_ACQUIRE) < job->n)
+        return LAB_NO_ERROR;
+
+    double begin = labNow();
+    checkpointSlot *slots = nextCheckpoint(&job->file);
+    for (long i = 0; i < job->n; ++i) {
+        double terms, sum;
+        seqRead(&job->threads[i].state.progress, &terms, &sum);
+        slots[i].blocks = terms / job->threads[i].params.range;
+        slots[i].sum = sum;
+    }
+    int code = commitCheckpoint(&job->file);
+    job->writes++;
+    job->seconds += labNow() - begin;
+    return code;
+}
+
+void * checkpointer(void * param) {
+    checkpointJob *job = (checkpointJob*)param;
+    while (waitWhileRunning(labNow() + options.checkpointInterval)) {
+        int code = writeCheckpoint(job);
+        if (code != LAB_NO_ERROR)
+            printError(code, pthread_self(), "can't write checkpoint");
+    }
+    return param;
+}
+
+void initThreads(threadLabNode *threads, long n, double range, double base) {
+    leibnizSumFunc sum = leibnizSumFor(options.kernel, options.simd);
     for (long i = 0; i < n; ++i) {
-        runParams params = {range*i, range, n};
+        runParams params = {i, range*(base + i), range, n, sum};
         threads[i] = constructNode(params);
     }
 }
 
+/*
+ * Takes the tuned config for every setting not given on the command line,
+ * a block is one tuned chunk of indexes
+ */
+void applyTune(int given) {
+    if (options.tune == LAB_TUNE_OFF) {
+        if (options.tuneFile != NULL) {
+            printf("--tune-file needs --tune\n");
+            exit(LAB_BAD_ARGS);
+        }
+        return;
+    }
+    char path[PATH_MAX];
+    int code = tunePath(path, sizeof(path), options.tuneFile);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't name tune file");
+        exit(LAB_BAD_ARGS);
+    }
+    tuneConfig tuned;
+    int calibrated;
+    code = loadOrCalibrate(path, options.tune == LAB_TUNE_FORCE, &tuned, &calibrated, NULL);
+    if (code != LAB_NO_ERROR) printError(code, pthread_self(), "can't save tune file, using the calibration once");
+
+    tunedThreads = tuned.threads;
+    if (!(given & LAB_GIVEN_KERNEL)) options.kernel = tuned.kernel;
+    if (!(given & LAB_GIVEN_SIMD)) options.simd = tuned.simd;
+    if (!(given & LAB_GIVEN_RANGE)) options.range = tuned.chunk * kernels[options.kernel].termsPerIndex;
+    printf("tune=%s %s threads=%ld chunk=%ld kernel=%s simd=%s terms/sec=%.6g\n", path, calibrated ? "calibrated" : "loaded",
+        tuned.threads, tuned.chunk, kernels[tuned.kernel].name, simdNames[tuned.simd], tuned.rate);
+}
+
+/**
+ * Removes --options from argv, so positional arguments keep their places
+ */
+void parseOptions(int *argc, char *argv[]) {
+    int positional = 1;
+    int given = 0; // LAB_GIVEN_* settings the tuned config doesn't override
+    for (int i = 1; i < *argc; ++i) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            argv[positional++] = arg;
+        } else if (strcmp(arg, "--scalar") == 0) {
+            options.simd = LAB_SIMD_SCALAR;
+            given |= LAB_GIVEN_SIMD;
+        } else if (strncmp(arg, "--simd=", 7) == 0) {
+            options.simd = parseSimd(arg + 7);
+            given |= LAB_GIVEN_SIMD;
+            if (options.simd < LAB_SIMD_AUTO) {
+                printf("simd must be one of: auto scalar sse2 avx2 avx512\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--kernel=", 9) == 0) {
+            options.kernel = parseKernel(arg + 9);
+            given |= LAB_GIVEN_KERNEL;
+            if (options.kernel < 0 || isBigKernel(options.kernel)) {
+                printf("kernel must be one of: leibniz paired\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--checkpoint=", 13) == 0) {
+            options.checkpoint = arg + 13;
+        } else if (strncmp(arg, "--checkpoint-interval=", 22) == 0) {
+            options.checkpointInterval = strtod(arg + 22, NULL);
+            if (options.checkpointInterval <= 0) {
+                printf("checkpoint interval must be a positive number of seconds\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strcmp(arg, "--resume") == 0) {
+            options.resume = 1;
+        } else if (strcmp(arg, "--shutdown=prefix") == 0) {
+            options.shutdown = LAB_SHUTDOWN_PREFIX;
+        } else if (strcmp(arg, "--shutdown=immediate") == 0) {
+            options.shutdown = LAB_SHUTDOWN_IMMEDIATE;
+        } else if (strncmp(arg, "--time-budget=", 14) == 0) {
+            options.budget = strtod(arg + 14, NULL);
+            if (options.budget <= 0) {
+                printf("time budget must be a positive number of seconds\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--progress=", 11) == 0) {
+            options.progress = strtod(arg + 11, NULL);
+            if (options.progress <= 0) {
+                printf("progress interval must be a positive number of seconds\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else if (strncmp(arg, "--range=", 8) == 0) {
+            options.range = strtol(arg + 8, NULL, 10);
+            if (options.range <= 0) {
+                printf("range must be a positive number of terms\n");
+                exit(LAB_BAD_ARGS);
+            }
+            given |= LAB_GIVEN_RANGE;
+        } else if (strcmp(arg, "--perf") == 0) {
+            options.perf = 1;
+        } else if (strcmp(arg, "--tune") == 0) {
+            options.tune = LAB_TUNE_LOAD;
+        } else if (strcmp(arg, "--tune=force") == 0) {
+            options.tune = LAB_TUNE_FORCE;
+        } else if (strncmp(arg, "--tune-file=", 12) == 0) {
+            options.tuneFile = arg + 12;
+        } else if (strncmp(arg, "--stop-latency=", 15) == 0) {
+            options.stopLatency = strtod(arg + 15, NULL) / 1000;
+            if (options.stopLatency <= 0) {
+                printf("stop latency must be a positive number of milliseconds\n");
+                exit(LAB_BAD_ARGS);
+            }
+        } else {
+            printf("unknown option: %s\n", arg);
+            exit(LAB_BAD_ARGS);
+        }
+    }
+    *argc = positional;
+
+    if (options.resume && options.checkpoint == NULL) {
+        printf("--resume needs --checkpoint=file\n");
+        exit(LAB_BAD_ARGS);
+    }
+
+    applyTune(given);
+    if (options.range % kernels[options.kernel].termsPerIndex != 0) {
+        printf("range must be a multiple of %d terms for the %s kernel\n", kernels[options.kernel].termsPerIndex, kernels[options.kernel].name);
+        exit(LAB_BAD_ARGS);
+    }
+
+    if (options.simd == LAB_SIMD_AUTO) {
+        options.simd = detectSimd();
+    } else if (!isSimdSupported(options.simd)) {
+        printf("%s is not supported by this cpu\n", simdNames[options.simd]);
+        exit(LAB_BAD_ARGS);
+    }
+}
+
 void initAndMayBeDie(int argc, char *argv[], long *n) {
+    parseOptions(&argc, argv);
     if (argc < 2) {
-        printf("args: threadsNumber\n");
+        printf("args: threadsNumber|auto [ --kernel=leibniz|paired ] [ --scalar | --simd=auto|scalar|sse2|avx2|avx512 ]\n"
+               "      [ --checkpoint=file [ --checkpoint-interval=seconds ] [ --resume ] ] [ --stop-latency=ms ]\n"
+               "      [ --shutdown=prefix|immediate ] [ --progress=seconds ] [ --perf ]\n"
+               "      [ --time-budget=seconds ] [ --range=terms ] [ --tune[=force] [ --tune-file=path ] ]\n");
         exit(LAB_BAD_ARGS);
     }
 
+    if (strcmp(argv[1], "auto") == 0) {
+        *n = tunedThreads > 0 ? tunedThreads : availableCpus();
+        return;
+    }
     *n = strtol(argv[1], (char **)NULL, 10);
 
     if (errno) {
@@ -173,33 +598,185 @@ void initAndMayBeDie(int argc, char *argv[], long *n) {
     }
 }
 
+void printRate(threadLabNode *finishedThreads, long n, double wall, double pi) {
+    double perThread = 0;
+    double terms = 0;
+    for (long i = 0; i < n; ++i) {
+        runState p = finishedThreads[i].state;
+        terms += p.terms;
+        if (p.seconds > 0) perThread += p.terms / p.seconds;
+        if (options.perf) {
+            char label[32];
+            snprintf(label, sizeof(label), "thread %ld", i);
+            // discarded terms were summed too, so they count in the cost
+            printPerf(stdout, label, &finishedThreads[i].perf, p.terms + p.discarded, "term");
+        }
+    }
+    printf("kernel=%s simd=%s terms=%.0f wall=%.6fs terms/sec=%.6g per thread=%.6g error=%.6g\n",
+        kernels[options.kernel].name, simdNames[options.simd], terms, wall, terms / wall, perThread / n, fabs(pi - M_PI));
+}
+
+void printBudget(threadLabNode *finishedThreads, long n, double end) {
+    printf("budget=%.3fs overshoot=%.3fms per thread terms=", options.budget, (end - deadline) * 1000);
+    for (long i = 0; i < n; ++i)
+        printf(i == 0 ? "%.0f" : " %.0f", finishedThreads[i].state.terms);
+    printf("\n");
+}
+
+void printStop(threadLabNode *finishedThreads, long n, double latency) {
+    long maxChunk = 0;
+    for (long i = 0; i < n; ++i)
+        if (finishedThreads[i].state.maxChunk > maxChunk) maxChunk = finishedThreads[i].state.maxChunk;
+    printf("stop latency=%.3fms bound=%.3fms max chunk=%ld blocks\n", latency * 1000, options.stopLatency * 1000, maxChunk);
+    if (options.shutdown != LAB_SHUTDOWN_PREFIX)
+        return;
+
+    double wasted = 0, agree = 0;
+    for (long i = 0; i < n; ++i) {
+        wasted += finishedThreads[i].state.discarded;
+        agree = fmax(agree, finishedThreads[i].state.agreeSeconds);
+    }
+    double prefix = finishedThreads[0].state.prefix;
+    printf("prefix=%.0f blocks terms=%.0f wasted=%.0f terms extra latency=%.3fms\n", prefix, prefix * options.range, wasted, agree * 1000);
+}
+
+/*
+ * Loads the checkpoint to continue from, any thread count may resume it
+ */
+void resumeOrDie() {
+    if (!options.resume)
+        return;
+
+    int code = loadCheckpoint(options.checkpoint, &resumed);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't load checkpoint");
+        exit(LAB_CANT_CHECKPOINT);
+    }
+    // block numbers of the checkpoint only make sense with its range
+    if (resumed.range % kernels[options.kernel].termsPerIndex != 0) {
+        printf("checkpoint range %ld is not a multiple of %d terms for the %s kernel\n",
+            resumed.range, kernels[options.kernel].termsPerIndex, kernels[options.kernel].name);
+        exit(LAB_CANT_CHECKPOINT);
+    }
+    options.range = resumed.range;
+    checkpointFrontier(&resumed, &resumeFrom, &resumeTo);
+}
+
+/*
+ * Blocks the resumed checkpoint left undone below resumeTo
+ */
+double resumedHoles() {
+    double holes = 0;
+    for (double block = resumeFrom; block < resumeTo; ++block)
+        if (!checkpointHasBlock(&resumed, block)) holes++;
+    return holes;
+}
+
+void printCheckpoint(checkpointJob *job) {
+    printf("checkpoint=%s writes=%ld write time=%.6fs", options.checkpoint, job->writes, job->seconds);
+    if (options.resume) {
+        double holes = resumedHoles();
+        printf(" resumed terms=%.0f threads=%ld refilled=%.0f", (resumeTo - holes) * options.range, resumed.threads, holes * options.range);
+    }
+    printf("\n");
+}
+
 double runMultiThreadCalculations(long n) {
-    threadLabNode *threads = malloc(sizeof(threadLabNode) * n);
+    double begin = labNow();
+    if (options.budget > 0) deadline = begin + options.budget;
+    threadLabNode *threads = aligned_alloc(LAB_CACHE_LINE, sizeof(threadLabNode) * n);
     if (threads == NULL) {
         printError(ENOMEM, pthread_self(), "threads number is too big");
         exit(LAB_CANT_CREATE_THREADS);
     }
     
-    initThreads(threads, n, LAB_RANGE);
+    resumeOrDie();
+    double baseSum = checkpointSum(&resumed);
+    initThreads(threads, n, options.range, resumeTo);
+    workers = threads;
+    if (!initProgress(&progress, n, (resumeTo - resumedHoles()) * options.range, baseSum)) {
+        printError(ENOMEM, pthread_self(), "can't allocate progress report");
+        exit(LAB_BAD_ALLOC);
+    }
+    for (long i = 0; i < n; ++i) progress.slots[i] = &threads[i].state.progress;
+
+    pthread_t controlThread;
+    int code = pthread_create(&controlThread, NULL, control, NULL);
+    if (code != LAB_NO_ERROR) {
+        printError(code, pthread_self(), "can't start signal thread");
+        exit(LAB_CANT_CREATE_THREADS);
+    }
+
+    checkpointJob job = {.threads = threads, .n = n, .writes = 0, .seconds = 0};
+    pthread_t checkpointThread;
+    if (options.checkpoint != NULL) {
+        code = createCheckpoint(&job.file, options.checkpoint, options.range, n, resumeTo, baseSum);
+        if (code != LAB_NO_ERROR) {
+            printError(code, pthread_self(), "can't create checkpoint");
+            exit(LAB_CANT_CHECKPOINT);
+        }
+    }
     
     threadLabNode * problem = runThreads(threads, n);
     if (problem != NULL) {
         printError(problem->status, problem->thread, "thread creation problem, calling exit");
         exit(LAB_CANT_CREATE_THREADS);
     } 
+    if (options.checkpoint != NULL) {
+        code = pthread_create(&checkpointThread, NULL, checkpointer, &job);
+        if (code != LAB_NO_ERROR) {
+            printError(code, pthread_self(), "can't start checkpoint thread");
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+    }
+    pthread_t reporterThread;
+    if (options.progress > 0) {
+        code = pthread_create(&reporterThread, NULL, reporter, NULL);
+        if (code != LAB_NO_ERROR) {
+            printError(code, pthread_self(), "can't start progress thread");
+            exit(LAB_CANT_CREATE_THREADS);
+        }
+    }
 
     problem = waitUntilAllThreadsFinish(threads, n);
     if (problem != NULL) {
         printError(problem->status, problem->thread, "couldn't wait for this thread due to some error");
         exit(LAB_CANT_WAIT_FOR_THREADS);
     }
+    double end = labNow();
+    double stopLatency = end - stopAt;
+
+    // releases the signal thread if it is still waiting
+    pthread_kill(controlThread, SIGUSR2);
+    pthread_join(controlThread, NULL);
+    if (options.progress > 0)
+        pthread_join(reporterThread, NULL);
+
+    if (options.checkpoint != NULL) {
+        pthread_join(checkpointThread, NULL);
+        int code = writeCheckpoint(&job);
+        if (code != LAB_NO_ERROR) {
+            printError(code, pthread_self(), "can't write checkpoint");
+            exit(LAB_CANT_CHECKPOINT);
+        }
+        closeCheckpoint(&job.file);
+    }
 
+    double pi = 4.0 * (baseSum + collectResults(threads, n));
+    printRate(threads, n, labNow() - begin, pi);
+    printStop(threads, n, stopLatency);
+    if (options.budget > 0)
+        printBudget(threads, n, end);
+    if (options.checkpoint != NULL)
+        printCheckpoint(&job);
+    freeProgress(&progress);
+    freeCheckpointState(&resumed);
     free(threads);
-    return 4.0 * collectResults(threads, n);
+    return pi;
 }
 
 int main(int argc, char *argv[]) {
-    setSigcatch();
+    blockSignalsOrDie();
     
     long n;
     initAndMayBeDie(argc, argv, &n);